@@ -0,0 +1,183 @@
+#ifndef ADDRESS_TAKEN_INDEX_H
+#define ADDRESS_TAKEN_INDEX_H
+
+#include <llvm/ADT/DenseSet.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/InstrTypes.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
+#include <map>
+#include <vector>
+
+using namespace llvm;
+
+///
+/// 模块中被取过地址的函数，按函数类型分组
+///
+/// 被取过地址指函数除了作为直接调用的被调函数以外还有别的用法：存进内存、作为实参传递、
+/// 出现在全局变量的初始值中等等。经过类型转换的直接调用（比如 call (bitcast @f)）仍然
+/// 算直接调用，llvm.used 和 llvm.compiler.used 中的引用不算。只有这些函数可能是间接调用
+/// 的目标，所以每个间接调用点的被调函数不会超出类型兼容的那几组（见 getCandidates）。
+///
+/// 每个模块只计算一次，分析引擎在超出预算时用它给出保守的答案，选择入口函数和输出结果
+/// 时也用它。懒加载模式下没有读入的函数体中的用法是看不到的，读入函数体以后要调用
+/// addFunctionBody 补充；跨模块导入时其他模块中的用法也看不到。这两种情况下调用
+/// setIncomplete，使用者不再把候选函数当作完整的答案。
+///
+class AddressTakenIndex {
+public:
+  explicit AddressTakenIndex(Module &M) {
+    for (Function &F : M) {
+      addIfAddressTaken(&F);
+      if (!F.isDeclaration() && !F.isMaterializable()) {
+        scanned.insert(&F);
+      }
+    }
+  }
+
+  /// 函数体读入以后，检查其中引用的函数是否因此被取了地址
+  void addFunctionBody(Function *F) {
+    if (!scanned.insert(F).second) {
+      return;
+    }
+    std::vector<const Constant *> worklist;
+    for (const BasicBlock &BB : *F) {
+      for (const Instruction &inst : BB) {
+        for (const Use &U : inst.operands()) {
+          if (const Constant *C = dyn_cast<Constant>(U.get())) {
+            worklist.push_back(C);
+          }
+        }
+      }
+    }
+    DenseSet<const Constant *> visited;
+    while (!worklist.empty()) {
+      const Constant *C = worklist.back();
+      worklist.pop_back();
+      if (!visited.insert(C).second) {
+        continue;
+      }
+      if (const Function *G = dyn_cast<Function>(C)) {
+        addIfAddressTaken(const_cast<Function *>(G));
+      } else if (!isa<GlobalValue>(C)) {
+        for (const Use &U : C->operands()) {
+          worklist.push_back(cast<Constant>(U.get()));
+        }
+      }
+    }
+  }
+
+  /// 还有没检查过的函数体时索引不完整，getCandidates 可能漏掉真实的目标
+  void setIncomplete() { complete = false; }
+  bool isComplete() const { return complete; }
+
+  bool isAddressTaken(const Function *F) const {
+    return addressTaken.count(F) > 0;
+  }
+
+  /// 类型为 type 的函数能否在这个调用点被调用：参数个数相同（可变参数的函数可以多传），
+  /// 每个参数和返回值的类型相同或者都是指针（C 程序中常有指针类型的强制转换）
+  static bool isCompatible(const CallBase *call, FunctionType *type) {
+    if (call->getFunctionType() == type) {
+      return true;
+    }
+    unsigned num = type->getNumParams();
+    if (call->arg_size() < num ||
+        (call->arg_size() > num && !type->isVarArg())) {
+      return false;
+    }
+    for (unsigned i = 0; i < num; i++) {
+      if (!isCompatible(call->getArgOperand(i)->getType(),
+                        type->getParamType(i))) {
+        return false;
+      }
+    }
+    // 不使用返回值的调用可以调用任何返回类型的函数
+    return call->getType()->isVoidTy() ||
+           isCompatible(call->getType(), type->getReturnType());
+  }
+
+  /// F 是否可能是这个调用点的目标。只检查类型而不要求被取过地址：索引看不到导入或者
+  /// 读入的函数中新出现的用法，不完整的索引会漏掉真实的目标
+  static bool isPossibleTarget(const CallBase *call, const Function *F) {
+    return isDirectCallee(call, F) || isCompatible(call, F->getFunctionType());
+  }
+
+  /// 静态已知的被调函数一定是目标，即使经过类型转换以后类型对不上
+  /// （比如 call (bitcast @f)，调用处看到的是 K&R 风格的声明）
+  static bool isDirectCallee(const CallBase *call, const Function *F) {
+    return call->getCalledOperand()->stripPointerCasts() == F;
+  }
+
+  /// 间接调用点所有可能的目标，兼容性按类型检查而不是逐个函数检查
+  std::vector<Function *> getCandidates(const CallBase *call) const {
+    std::vector<Function *> candidates;
+    for (const auto &entry : bySignature) {
+      if (isCompatible(call, entry.first)) {
+        candidates.insert(candidates.end(), entry.second.begin(),
+                          entry.second.end());
+      }
+    }
+    return candidates;
+  }
+
+  size_t getNumCandidates(const CallBase *call) const {
+    size_t num = 0;
+    for (const auto &entry : bySignature) {
+      if (isCompatible(call, entry.first)) {
+        num += entry.second.size();
+      }
+    }
+    return num;
+  }
+
+private:
+  DenseSet<const Function *> addressTaken;
+  DenseSet<const Function *> scanned; // 已经检查过函数体的函数
+  std::map<FunctionType *, std::vector<Function *>> bySignature;
+  bool complete = true;
+
+  void addIfAddressTaken(Function *F) {
+    if (F->isIntrinsic() || addressTaken.count(F) || !hasAddressTaken(F)) {
+      return;
+    }
+    addressTaken.insert(F);
+    bySignature[F->getFunctionType()].push_back(F);
+  }
+
+  /// 常量表达式（比如类型转换）和常量数组、结构体要看它们自己的用法
+  static bool hasAddressTaken(const Value *V) {
+    for (const Use &U : V->uses()) {
+      const User *user = U.getUser();
+      if (const CallBase *call = dyn_cast<CallBase>(user)) {
+        if (call->isCallee(&U)) {
+          continue;
+        }
+        return true;
+      }
+      if (const GlobalVariable *GV = dyn_cast<GlobalVariable>(user)) {
+        if (GV->getName() == "llvm.used" ||
+            GV->getName() == "llvm.compiler.used") {
+          continue;
+        }
+        return true;
+      }
+      if (isa<Constant>(user) && !isa<GlobalValue>(user)) {
+        if (hasAddressTaken(user)) {
+          return true;
+        }
+        continue;
+      }
+      return true;
+    }
+    return false;
+  }
+
+  static bool isCompatible(Type *a, Type *b) {
+    return a == b || (a->isPointerTy() && b->isPointerTy());
+  }
+};
+
+#endif // ADDRESS_TAKEN_INDEX_H
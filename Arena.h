@@ -0,0 +1,135 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <llvm/Support/Allocator.h>
+#include <cstddef>
+#include <new>
+#include <scoped_allocator>
+
+using namespace llvm;
+
+///
+/// 一次数据流分析专用的内存池
+///
+/// 底层是 BumpPtrAllocator，分析结束时随对象析构整体释放。
+/// 容器节点在分析过程中被反复创建和销毁（状态拷贝、临时队列），
+/// 所以对小块内存按大小维护空闲链表，避免内存池在不动点迭代中无限增长。
+///
+class StateArena {
+public:
+  StateArena() : freeLists() {}
+  StateArena(const StateArena &) = delete;
+  StateArena &operator=(const StateArena &) = delete;
+
+  void *allocate(size_t size, size_t align) {
+    size_t idx = sizeClass(size, align);
+    if (idx < NumSizeClasses && freeLists[idx]) {
+      FreeNode *node = freeLists[idx];
+      freeLists[idx] = node->next;
+      return node;
+    }
+    if (idx < NumSizeClasses) {
+      size = (idx + 1) * Granularity;
+    }
+    return allocator.Allocate(size, align);
+  }
+
+  void deallocate(void *ptr, size_t size, size_t align) {
+    size_t idx = sizeClass(size, align);
+    if (idx < NumSizeClasses) {
+      FreeNode *node = static_cast<FreeNode *>(ptr);
+      node->next = freeLists[idx];
+      freeLists[idx] = node;
+    }
+    // 大块内存直接留在池里，等分析结束时一起释放
+  }
+
+  size_t getBytesAllocated() const { return allocator.getBytesAllocated(); }
+
+private:
+  struct FreeNode {
+    FreeNode *next;
+  };
+
+  static const size_t Granularity = alignof(std::max_align_t);
+  static const size_t NumSizeClasses = 256 / Granularity;
+
+  static size_t sizeClass(size_t size, size_t align) {
+    if (align > Granularity || size == 0) {
+      return NumSizeClasses;
+    }
+    return (size - 1) / Granularity;
+  }
+
+  BumpPtrAllocator allocator;
+  FreeNode *freeLists[NumSizeClasses];
+};
+
+/// 当前线程上正在进行的分析所使用的内存池，为空时使用全局堆
+inline StateArena *&currentArena() {
+  static thread_local StateArena *arena = nullptr;
+  return arena;
+}
+
+///
+/// 在作用域内把 arena 设为当前内存池，离开作用域时恢复
+/// 注意 arena 本身必须比作用域内创建的所有容器活得更久
+///
+class ArenaScope {
+public:
+  explicit ArenaScope(StateArena &arena) : saved(currentArena()) {
+    currentArena() = &arena;
+  }
+  ~ArenaScope() { currentArena() = saved; }
+
+  ArenaScope(const ArenaScope &) = delete;
+  ArenaScope &operator=(const ArenaScope &) = delete;
+
+private:
+  StateArena *saved;
+};
+
+///
+/// 标准库容器使用的分配器
+///
+/// 默认构造和拷贝构造容器时都绑定到当前的内存池，因此在被调函数的分析中拷贝出的状态
+/// 会落在被调函数的内存池里；已有容器的赋值和插入则始终使用容器自己的内存池。
+///
+template <class T> struct ArenaAllocator {
+  typedef T value_type;
+
+  StateArena *arena;
+
+  ArenaAllocator() : arena(currentArena()) {}
+  explicit ArenaAllocator(StateArena *arena) : arena(arena) {}
+  template <class U>
+  ArenaAllocator(const ArenaAllocator<U> &other) : arena(other.arena) {}
+
+  T *allocate(size_t n) {
+    if (arena) {
+      return static_cast<T *>(arena->allocate(n * sizeof(T), alignof(T)));
+    }
+    return static_cast<T *>(::operator new(n * sizeof(T)));
+  }
+
+  void deallocate(T *ptr, size_t n) {
+    if (arena) {
+      arena->deallocate(ptr, n * sizeof(T), alignof(T));
+    } else {
+      ::operator delete(ptr);
+    }
+  }
+
+  ArenaAllocator select_on_container_copy_construction() const {
+    return ArenaAllocator();
+  }
+
+  template <class U> bool operator==(const ArenaAllocator<U> &other) const {
+    return arena == other.arena;
+  }
+  template <class U> bool operator!=(const ArenaAllocator<U> &other) const {
+    return arena != other.arena;
+  }
+};
+
+#endif // ARENA_H
@@ -0,0 +1,194 @@
+#ifndef ARG_MOD_REF_H
+#define ARG_MOD_REF_H
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/Module.h>
+#include <vector>
+
+using namespace llvm;
+
+///
+/// 过程间的形参读写预分析
+///
+/// 对每个函数的每个指针形参，判断这个函数以及它（传递地）调用的函数是否可能通过这个形参
+/// 读或者写内存，也就是会不会访问实参可达的那些对象。分析是流不敏感的，只看 SSA 的使用
+/// 关系，再加上 -O0 下形参先存进局部变量再取出来的模式。遇到看不懂的用法一律当作既读又写。
+/// 懒加载模式下还没有读入函数体的函数与外部函数一样当作既读又写，读入以后再补充分析。
+///
+class ArgModRef {
+public:
+  enum Effect : unsigned char { NoEffect = 0, Ref = 1, Mod = 2, ModRef = 3 };
+
+  explicit ArgModRef(Module &M) {
+    std::vector<Function *> functions;
+    for (Function &F : M) {
+      if (!F.isDeclaration() && !F.isMaterializable()) {
+        effects[&F].assign(F.arg_size(), NoEffect);
+        functions.push_back(&F);
+      }
+    }
+    solve(functions);
+  }
+
+  /// 懒加载模式下函数体读入以后补充分析它的形参，之前分析过的调用者保留保守的结果
+  void addFunction(Function *F) {
+    if (F->empty() || effects.count(F)) {
+      return;
+    }
+    effects[F].assign(F->arg_size(), NoEffect);
+    solve({F});
+  }
+
+  /// 函数 F 通过第 argNo 个形参可能产生的读写，不认识的函数一律当作既读又写
+  unsigned char getEffect(const Function *F, unsigned argNo) const {
+    auto iter = effects.find(F);
+    if (iter == effects.end() || argNo >= iter->second.size()) {
+      return ModRef;
+    }
+    return iter->second[argNo];
+  }
+
+private:
+  DenseMap<const Function *, std::vector<unsigned char>> effects;
+
+  /// 被调函数的结果会影响调用者，迭代到不动点
+  void solve(const std::vector<Function *> &functions) {
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (Function *F : functions) {
+        for (unsigned i = 0; i < F->arg_size(); i++) {
+          if (!F->getArg(i)->getType()->isPointerTy()) {
+            continue;
+          }
+          unsigned char effect = computeArgEffect(F->getArg(i));
+          if ((effects[F][i] | effect) != effects[F][i]) {
+            effects[F][i] |= effect;
+            changed = true;
+          }
+        }
+      }
+    }
+  }
+
+  unsigned char computeArgEffect(Argument *arg) {
+    unsigned char effect = NoEffect;
+    SmallPtrSet<Value *, 16> derived;   // 值来自形参可达的内存
+    SmallPtrSet<AllocaInst *, 4> slots; // 存放过这类值的局部变量
+    SmallVector<Value *, 16> worklist = {arg};
+    derived.insert(arg);
+
+    auto addDerived = [&](Value *v) {
+      if (derived.insert(v).second) {
+        worklist.push_back(v);
+      }
+    };
+
+    while (!worklist.empty() && effect != ModRef) {
+      Value *v = worklist.pop_back_val();
+      for (User *user : v->users()) {
+        if (isa<GetElementPtrInst>(user) || isa<CastInst>(user) ||
+            isa<PHINode>(user) || isa<SelectInst>(user)) {
+          addDerived(user);
+        } else if (LoadInst *load = dyn_cast<LoadInst>(user)) {
+          // 从形参可达的内存中读出来的值，也是形参可达的
+          effect |= Ref;
+          addDerived(load);
+        } else if (StoreInst *store = dyn_cast<StoreInst>(user)) {
+          Value *dest = store->getPointerOperand();
+          if (derived.count(dest)) {
+            effect |= Mod;
+            continue;
+          }
+          // 值被存到了别的地方：局部变量只是暂存，其他情况就逃逸了
+          AllocaInst *slot = dyn_cast<AllocaInst>(dest->stripPointerCasts());
+          if (!slot) {
+            effect |= ModRef;
+          } else if (slots.insert(slot).second) {
+            effect |= addSlotLoads(slot, addDerived);
+          }
+        } else if (CallInst *call = dyn_cast<CallInst>(user)) {
+          effect |= callEffect(call, v);
+          // 被调函数返回的指针可能就是从实参可达的内存里取出来的
+          if (call->getType()->isPointerTy()) {
+            addDerived(call);
+          }
+        } else if (isa<ReturnInst>(user) || isa<CmpInst>(user)) {
+          // 返回给调用者或者只比较地址，不访问内存
+        } else {
+          effect |= ModRef;
+        }
+      }
+    }
+    return effect;
+  }
+
+  /// 局部变量中暂存的值被读出来以后也是形参可达的，除了直接的读写以外，
+  /// 局部变量的其他用法都可能让我们漏掉读出来的值，按逃逸处理
+  template <class AddFn>
+  static unsigned char addSlotLoads(AllocaInst *slot, AddFn addDerived) {
+    for (User *user : slot->users()) {
+      if (LoadInst *load = dyn_cast<LoadInst>(user)) {
+        addDerived(load);
+      } else if (StoreInst *store = dyn_cast<StoreInst>(user)) {
+        if (store->getValueOperand() == slot) {
+          return ModRef;
+        }
+      } else if (!isa<DbgInfoIntrinsic>(user)) {
+        IntrinsicInst *intrinsic = dyn_cast<IntrinsicInst>(user);
+        if (!intrinsic || !intrinsic->isLifetimeStartOrEnd()) {
+          return ModRef;
+        }
+      }
+    }
+    return NoEffect;
+  }
+
+  /// v 作为实参传给 call 时，被调函数通过它产生的读写
+  unsigned char callEffect(CallInst *call, Value *v) {
+    if (call->getCalledOperand() == v && !call->hasArgument(v)) {
+      return NoEffect; // 只是通过它进行间接调用
+    }
+    if (isa<DbgInfoIntrinsic>(call)) {
+      return NoEffect;
+    }
+    if (MemTransferInst *transfer = dyn_cast<MemTransferInst>(call)) {
+      unsigned char effect = NoEffect;
+      if (transfer->getRawDest() == v) {
+        effect |= Mod;
+      }
+      if (transfer->getRawSource() == v) {
+        effect |= Ref;
+      }
+      return effect;
+    }
+    if (MemSetInst *memSet = dyn_cast<MemSetInst>(call)) {
+      return memSet->getRawDest() == v ? Mod : NoEffect;
+    }
+    if (IntrinsicInst *intrinsic = dyn_cast<IntrinsicInst>(call)) {
+      if (intrinsic->isLifetimeStartOrEnd()) {
+        return NoEffect;
+      }
+      return ModRef;
+    }
+
+    Function *callee = call->getCalledFunction();
+    if (!callee || callee->empty()) {
+      return ModRef;
+    }
+    unsigned char effect = NoEffect;
+    for (unsigned i = 0, num = call->arg_size(); i < num; i++) {
+      if (call->getArgOperand(i) == v) {
+        effect |= getEffect(callee, i);
+      }
+    }
+    return effect;
+  }
+};
+
+#endif // ARG_MOD_REF_H
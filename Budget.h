@@ -0,0 +1,114 @@
+#ifndef BUDGET_H
+#define BUDGET_H
+
+#include <llvm/Support/CommandLine.h>
+#include <chrono>
+#include <cstdint>
+
+using namespace llvm;
+
+static cl::opt<double>
+    TimeBudget("time-budget",
+               cl::desc("Seconds of precise analysis per module, later calls "
+                        "are approximated (0 = no limit)"),
+               cl::init(0));
+
+static cl::opt<uint64_t>
+    StepBudget("step-budget",
+               cl::desc("Instructions transferred per module before later "
+                        "calls are approximated (0 = no limit)"),
+               cl::init(0));
+
+static cl::opt<uint64_t> FunctionStepBudget(
+    "function-step-budget",
+    cl::desc("Instructions transferred in one analysis of a callee (not "
+             "counting its own callees) before it is approximated "
+             "(0 = no limit)"),
+    cl::init(0));
+
+static cl::opt<uint64_t>
+    StateBudget("state-budget",
+                cl::desc("State size in the analysis of a callee before it "
+                         "is approximated (0 = no limit)"),
+                cl::init(0));
+
+static cl::opt<unsigned> DepthBudget(
+    "depth-budget",
+    cl::desc("Nesting of callee analyses, deeper calls (e.g. recursion) are "
+             "approximated (default 64)"),
+    cl::init(64));
+
+///
+/// 超出的预算种类，也是被调函数改用近似分析的原因
+///
+enum class BudgetKind : unsigned {
+  None,
+  Time,
+  Steps,
+  FunctionSteps,
+  StateSize,
+  Depth,
+  NumKinds
+};
+
+inline const char *getBudgetName(BudgetKind kind) {
+  static const char *const names[] = {"none",       "time",
+                                      "steps",      "function-steps",
+                                      "state-size", "depth"};
+  return names[static_cast<unsigned>(kind)];
+}
+
+///
+/// 一次模块分析的全局预算（时间和转移步数）
+///
+/// 用完以后分析不会中止：已经开始的入口函数照常算完自己的不动点，但是还没有摘要的
+/// 被调函数不再递归精确分析，改用流不敏感的近似（见 PointToVisitor::approximateCall），
+/// 所以分析总能在有限时间内结束。预算只在调用点和基本块之间检查。
+///
+class AnalysisBudget {
+public:
+  AnalysisBudget() : start(std::chrono::steady_clock::now()) {}
+
+  void addStep() { steps++; }
+
+  /// 全局预算用完时返回原因，之后一直返回同一个原因
+  BudgetKind check() {
+    if (exceeded != BudgetKind::None) {
+      return exceeded;
+    }
+    if (StepBudget && steps > StepBudget) {
+      exceeded = BudgetKind::Steps;
+    } else if (TimeBudget > 0 &&
+               std::chrono::duration<double>(
+                   std::chrono::steady_clock::now() - start)
+                       .count() > TimeBudget) {
+      exceeded = BudgetKind::Time;
+    }
+    return exceeded;
+  }
+
+  /// 记录一次改用近似的调用
+  void addDegraded(BudgetKind kind) {
+    degraded[static_cast<unsigned>(kind)]++;
+  }
+
+  uint64_t getDegraded(BudgetKind kind) const {
+    return degraded[static_cast<unsigned>(kind)];
+  }
+
+  uint64_t getTotalDegraded() const {
+    uint64_t total = 0;
+    for (uint64_t count : degraded) {
+      total += count;
+    }
+    return total;
+  }
+
+private:
+  std::chrono::steady_clock::time_point start;
+  uint64_t steps = 0;
+  BudgetKind exceeded = BudgetKind::None;
+  uint64_t degraded[static_cast<unsigned>(BudgetKind::NumKinds)] = {};
+};
+
+#endif // BUDGET_H
@@ -0,0 +1,241 @@
+#ifndef CROSS_MODULE_IMPORTER_H
+#define CROSS_MODULE_IMPORTER_H
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/Twine.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IRReader/IRReader.h>
+#include <llvm/Linker/IRMover.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/SourceMgr.h>
+#include <llvm/Support/raw_ostream.h>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+using namespace llvm;
+
+///
+/// 跨模块按需导入函数体
+///
+/// 程序的其他模块只在开始时懒加载一次，建立“函数名 -> 定义它的模块”的符号表，
+/// 函数体不会被读入。分析到达一个声明时，再从定义它的模块中把函数体导入进来。
+///
+/// 分析的状态中保存着 Function 指针，所以导入不能像普通的链接那样用新函数替换掉声明：
+/// 先用临时的名字把函数链接进来，再把函数体整体移到原来的声明上，声明的地址保持不变。
+///
+/// 同一个模块中的局部符号（static 函数和变量、字符串常量）无论被几次导入用到，都只链接
+/// 一份：链接时把它们临时改成带模块编号的外部符号，以后的导入按名字链接到第一次的副本上，
+/// 链接完成后副本再恢复原来的名字和链接属性。局部函数先链接成声明，与外部函数一样在
+/// 分析到达时才导入函数体。
+///
+class CrossModuleImporter {
+public:
+  explicit CrossModuleImporter(Module &dest) : dest(dest), mover(dest) {}
+
+  /// 把一个模块加入符号表，同名的外部函数以先加入的模块为准
+  /// @return 读入失败时返回 false，错误信息写到 err
+  bool addModule(StringRef filename, raw_ostream &err) {
+    auto buffer = MemoryBuffer::getFile(filename);
+    if (!buffer) {
+      err << filename << ": " << buffer.getError().message() << "\n";
+      return false;
+    }
+    unsigned index = buffers.size();
+    buffers.push_back(std::move(*buffer));
+    locals.emplace_back();
+
+    std::unique_ptr<Module> module = loadModule(index, err);
+    if (!module) {
+      return false;
+    }
+    for (Function &F : *module) {
+      if (!F.isDeclaration() && !F.hasLocalLinkage()) {
+        definitions.try_emplace(F.getName(), index);
+      }
+    }
+    return true;
+  }
+
+  /// 如果 decl 在其他模块中有定义，把函数体导入到 decl 上
+  /// @return 导入成功时返回 true
+  bool import(Function *decl) {
+    if (!decl->isDeclaration() || decl->isMaterializable()) {
+      return false;
+    }
+    // decl 可能是以前的导入带进来的局部函数，也可能是普通的外部函数
+    unsigned index;
+    std::string srcName;
+    auto local = localDecls.find(decl);
+    bool isLocal = local != localDecls.end();
+    if (isLocal) {
+      std::tie(index, srcName) = local->second;
+    } else {
+      auto iter = definitions.find(decl->getName());
+      if (iter == definitions.end()) {
+        return false;
+      }
+      index = iter->second;
+      srcName = decl->getName().str();
+    }
+
+    std::unique_ptr<Module> src = loadModule(index, errs());
+    if (!src) {
+      return false;
+    }
+    Function *srcFunc = src->getFunction(srcName);
+    if (!srcFunc || (!isLocal && srcFunc->getFunctionType() !=
+                                     decl->getFunctionType())) {
+      errs() << "Warning: " << decl->getName()
+             << " has a different signature in another module, skipped.\n";
+      return false;
+    }
+
+    // 用临时的名字链接进来，避免与已有的声明合并
+    StringMap<LinkedLocal> exported = exportLocals(*src, index);
+    srcFunc->setName(decl->getName() + ".imported");
+    std::string importedName = srcFunc->getName().str();
+    hideLinked();
+    // 局部变量连同初始值一起链接进来，局部函数只链接成声明，
+    // 分析到达时再像外部函数一样导入，读入的函数体都经过同样的处理
+    Error error = mover.move(
+        std::move(src), {srcFunc},
+        [&exported](GlobalValue &GV, IRMover::ValueAdder add) {
+          if (!isa<Function>(GV) && exported.count(GV.getName())) {
+            add(GV);
+          }
+        },
+        /*IsPerformingImport=*/false);
+    // 新链接进来的局部符号记下第一份副本
+    StringMap<LinkedLocal> &linked = locals[index];
+    for (auto &entry : exported) {
+      GlobalValue *copy = dest.getNamedValue(entry.getKey());
+      if (!copy || linked.count(entry.second.name)) {
+        continue;
+      }
+      entry.second.copy = copy;
+      linked.try_emplace(entry.second.name, entry.second);
+      if (Function *F = dyn_cast<Function>(copy)) {
+        localDecls[F] = std::make_pair(index, entry.second.name);
+      }
+    }
+    showLinked();
+    if (error) {
+      logAllUnhandledErrors(std::move(error), errs(),
+                            decl->getName() + ": ");
+      return false;
+    }
+    Function *imported = dest.getFunction(importedName);
+    if (!imported || imported->isDeclaration()) {
+      return false;
+    }
+    if (imported->getFunctionType() != decl->getFunctionType()) {
+      errs() << "Warning: " << decl->getName()
+             << " has a different signature in another module, skipped.\n";
+      imported->eraseFromParent();
+      return false;
+    }
+
+    // 函数体、形参和属性都转移到原来的声明上，递归调用也改为调用声明
+    decl->getBasicBlockList().splice(decl->end(),
+                                     imported->getBasicBlockList());
+    for (unsigned i = 0; i < decl->arg_size(); i++) {
+      imported->getArg(i)->replaceAllUsesWith(decl->getArg(i));
+      decl->getArg(i)->takeName(imported->getArg(i));
+    }
+    decl->copyAttributesFrom(imported);
+    decl->copyMetadata(imported, 0);
+    imported->replaceAllUsesWith(decl);
+    imported->eraseFromParent();
+    // 局部函数有了函数体以后才能恢复成局部的链接属性
+    if (isLocal) {
+      decl->setLinkage(locals[index][srcName].linkage);
+      localDecls.erase(decl);
+    }
+    return true;
+  }
+
+private:
+  /// 源模块中的局部符号链接到目标模块中的副本
+  struct LinkedLocal {
+    std::string name; // 副本在目标模块中的名字，与其他符号重名时会加上后缀
+    GlobalValue::LinkageTypes linkage;
+    GlobalValue *copy = nullptr;
+  };
+
+  Module &dest;
+  IRMover mover;
+  std::vector<std::unique_ptr<MemoryBuffer>> buffers;
+  StringMap<unsigned> definitions; // 函数名 -> buffers 的下标
+  // 每个模块中已经链接过的局部符号，源模块中的名字 -> 副本
+  std::vector<StringMap<LinkedLocal>> locals;
+  // 还没有导入函数体的局部函数 -> (buffers 的下标, 源模块中的名字)
+  DenseMap<Function *, std::pair<unsigned, std::string>> localDecls;
+
+  /// 局部符号链接时使用的名字，带上模块编号，不会与其他模块的符号混淆
+  static std::string getLinkName(StringRef name, unsigned index) {
+    return (name + ".import." + Twine(index)).str();
+  }
+
+  /// 把 src 中有名字的局部函数和变量改成带模块编号的外部符号
+  /// @return 改名后的名字 -> 原来的名字和链接属性
+  StringMap<LinkedLocal> exportLocals(Module &src, unsigned index) {
+    StringMap<LinkedLocal> exported;
+    for (GlobalObject &GO : src.global_objects()) {
+      if (!GO.hasLocalLinkage() || !GO.hasName() ||
+          !(isa<Function>(GO) || isa<GlobalVariable>(GO))) {
+        continue;
+      }
+      LinkedLocal local;
+      local.name = GO.getName().str();
+      local.linkage = GO.getLinkage();
+      GO.setName(getLinkName(local.name, index));
+      GO.setLinkage(GlobalValue::ExternalLinkage);
+      exported.try_emplace(GO.getName(), local);
+    }
+    return exported;
+  }
+
+  /// 链接之前把所有已经链接过的副本改成链接时的名字，IRMover 会把引用链接到副本上。
+  /// 其他模块的副本也要改名，否则它们原来的名字会被当作同名的外部符号
+  void hideLinked() {
+    for (unsigned index = 0; index < locals.size(); index++) {
+      for (auto &entry : locals[index]) {
+        entry.second.copy->setName(getLinkName(entry.getKey(), index));
+        entry.second.copy->setLinkage(GlobalValue::ExternalLinkage);
+      }
+    }
+  }
+
+  /// 链接之后副本恢复原来的名字和链接属性，声明只能是外部的
+  void showLinked() {
+    for (StringMap<LinkedLocal> &linked : locals) {
+      for (auto &entry : linked) {
+        GlobalValue *copy = entry.second.copy;
+        copy->setName(entry.second.name);
+        copy->setLinkage(copy->isDeclaration() ? GlobalValue::ExternalLinkage
+                                               : entry.second.linkage);
+        entry.second.name = copy->getName().str();
+      }
+    }
+  }
+
+  /// 每次导入都重新懒加载一遍源模块，IRMover 会消耗掉源模块，
+  /// 而懒加载只需要读符号表，代价很小
+  std::unique_ptr<Module> loadModule(unsigned index, raw_ostream &err) {
+    SMDiagnostic diag;
+    std::unique_ptr<Module> module = getLazyIRModule(
+        MemoryBuffer::getMemBuffer(buffers[index]->getMemBufferRef(),
+                                   /*RequiresNullTerminator=*/false),
+        diag, dest.getContext());
+    if (!module) {
+      diag.print(buffers[index]->getBufferIdentifier().data(), err);
+    }
+    return module;
+  }
+};
+
+#endif // CROSS_MODULE_IMPORTER_H
@@ -62,6 +62,12 @@ public:
   /// @return true if dest changed
   ///
   virtual void merge(T *dest, const T &src) = 0;
+
+  ///
+  /// Checked before each basic block, return true to abandon the iteration
+  /// (e.g. when a budget is exhausted). The result is then incomplete.
+  ///
+  virtual bool shouldStop() { return false; }
 };
 
 ///
@@ -102,7 +108,7 @@ void compForwardDataflow(Function *fn, DataflowVisitor<T> *visitor,
     worklist.insert(bb);
   }
 
-  while (!worklist.empty()) {
+  while (!worklist.empty() && !visitor->shouldStop()) {
     BasicBlock *bb = *worklist.begin();
     worklist.erase(worklist.begin());
 
@@ -116,24 +122,31 @@ void compForwardDataflow(Function *fn, DataflowVisitor<T> *visitor,
     }
     (*result)[bb].first = bbenterval;
 
-    LOG_DEBUG("Now handling basic block " << bb->getName() << " in function " << bb->getParent()->getName());
-    LOG_DEBUG("Incoming values: \n" << (*result)[bb].first);
+    LOG_DEBUG(LogDataflow, "Now handling basic block "
+                               << bb->getName() << " in function "
+                               << bb->getParent()->getName());
+    LOG_TRACE(LogDataflow, "Incoming values: \n" << (*result)[bb].first);
 
     visitor->compDFVal(bb, &bbenterval, true);
 
+    // 如果经过计算后outcome与上一次相比发生改变，那么在CFG中进行传播（把所有后继节点重新加入队列）
+    // 不能与income比较：不修改状态的基本块income总是等于outcome，后继就永远收不到更新了，
+    // 结果会依赖于基本块的处理顺序（worklist按地址排序）
+    // 状态的比较会先比较指纹，只有指纹相同时才需要深比较
+    bool changed = bbenterval != (*result)[bb].second;
     (*result)[bb].second = bbenterval;
-    // 如果经过计算后outcome发生改变，那么在CFG中进行传播（把所有后继节点重新加入队列）
-    if (bbenterval != (*result)[bb].first) {
-      // 好像没有必要？后集节点本来也是在队列里面的
+    if (changed) {
       for (succ_iterator si = succ_begin(bb), se = succ_end(bb); si != se;
            si++) {
         worklist.insert(*si);
       }
     }
 
-    LOG_DEBUG("Basic block " << bb->getName() << " in function " << bb->getParent()->getName() << " finished. ");
-    LOG_DEBUG("Incoming values: \n" << (*result)[bb].first);
-    LOG_DEBUG("Outcoming values: \n" << (*result)[bb].second);
+    LOG_DEBUG(LogDataflow, "Basic block " << bb->getName() << " in function "
+                                          << bb->getParent()->getName()
+                                          << " finished. ");
+    LOG_TRACE(LogDataflow, "Incoming values: \n" << (*result)[bb].first);
+    LOG_TRACE(LogDataflow, "Outcoming values: \n" << (*result)[bb].second);
   }
 }
 ///
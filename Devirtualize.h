@@ -0,0 +1,157 @@
+#ifndef DEVIRTUALIZE_H
+#define DEVIRTUALIZE_H
+
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/Utils/CallPromotionUtils.h>
+#include <algorithm>
+#include <set>
+#include <vector>
+
+#include "PointToAnalysis.h"
+#include "ResultWriter.h"
+#include "utils.h"
+
+using namespace llvm;
+
+static cl::opt<std::string> DevirtualizeOutput(
+    "devirtualize",
+    cl::desc("Rewrite indirect calls into direct calls using the analysis "
+             "results and write the module as bitcode to <file>"),
+    cl::value_desc("file"), cl::init(""));
+
+static cl::opt<unsigned> DevirtMaxTargets(
+    "devirt-max-targets",
+    cl::desc("Indirect calls with at most this many possible callees are "
+             "promoted to guarded direct calls (default 4)"),
+    cl::init(4));
+
+static cl::opt<bool> DevirtUnguarded(
+    "devirt-unguarded",
+    cl::desc("Call the only possible callee directly without a check when "
+             "every entry was analyzed (-whole-module), trusting the analysis "
+             "to be sound"),
+    cl::init(false));
+
+///
+/// 根据指向分析的结果把间接调用改写成直接调用
+///
+/// 被调函数不超过 -devirt-max-targets 个的调用点，改成依次把函数指针与每个被调函数比较、
+/// 相等时直接调用的分支链，都不相等时仍然走原来的间接调用。直接调用的分支可以内联，
+/// 原来的间接调用只是后备。
+///
+/// 只有一个可能的被调函数的调用点，在分析结果完整时可以去掉比较直接调用。完整需要所有
+/// 可能从外部进入的函数都作为入口分析过（-whole-module），而且调用点的函数指针没有未知的
+/// 来源（不在 getOpenCalls 中）。即使这样，分析本身也不总是可靠的：结构体和数组的各个
+/// 元素不加区分，却对它们做强更新，所以这一步要用 -devirt-unguarded 明确打开。
+///
+class Devirtualizer {
+public:
+  struct Result {
+    unsigned direct = 0;  // 改成直接调用的调用点
+    unsigned guarded = 0; // 改成比较分支链的调用点
+    unsigned skipped = 0; // 有分析结果但是没有改写的间接调用点
+  };
+
+  /// @param complete 分析是否覆盖了所有的调用上下文，并且可以信任
+  static Result run(const CallTargetMap &targets,
+                    const std::set<CallInst *> &openCalls, bool complete) {
+    Result result;
+    // 按位置排序，改写的顺序与指令在内存中的地址无关
+    std::vector<CallInst *> calls;
+    for (const auto &entry : targets) {
+      if (isIndirect(entry.first)) {
+        calls.push_back(entry.first);
+      }
+    }
+    std::stable_sort(calls.begin(), calls.end(),
+                     ResultWriter::compareLocation);
+
+    for (CallInst *call : calls) {
+      const std::set<Function *> &callees = targets.at(call);
+      std::vector<Function *> sorted(callees.begin(), callees.end());
+      std::sort(sorted.begin(), sorted.end(), [](Function *a, Function *b) {
+        return a->getName() < b->getName();
+      });
+      if (sorted.empty() || sorted.size() > DevirtMaxTargets ||
+          !canPromote(call, sorted)) {
+        result.skipped++;
+        continue;
+      }
+
+      if (sorted.size() == 1 && complete && !openCalls.count(call)) {
+        LOG_INFO(LogCall, "Devirtualizing call at "
+                              << getLocation(call) << " to "
+                              << sorted.front()->getName());
+        promoteCall(*call, sorted.front());
+        result.direct++;
+        continue;
+      }
+      // 每次比较都从原来的调用中复制出一个直接调用，原来的调用留在最后的 else 分支里
+      LOG_INFO(LogCall, "Promoting call at " << getLocation(call) << " to "
+                                             << sorted.size()
+                                             << " guarded direct call(s)");
+      for (Function *callee : sorted) {
+        promoteCallWithIfThenElse(*call, callee);
+      }
+      result.guarded++;
+    }
+    return result;
+  }
+
+  /// 改写后的模块写成 bitcode，模块不合法时不写
+  static bool write(Module &M, StringRef path, raw_ostream &err) {
+    // 懒加载模式下还有没有读入的函数体，写出之前要全部读入
+    if (Error E = M.materializeAll()) {
+      logAllUnhandledErrors(std::move(E), err, path + ": ");
+      return false;
+    }
+    if (verifyModule(M, &err)) {
+      err << path << ": the devirtualized module is broken, not written\n";
+      return false;
+    }
+    std::error_code ec;
+    raw_fd_ostream out(path, ec, sys::fs::OF_None);
+    if (ec) {
+      err << path << ": " << ec.message() << "\n";
+      return false;
+    }
+    WriteBitcodeToFile(M, out);
+    return true;
+  }
+
+private:
+  static bool isIndirect(CallInst *call) {
+    return !call->isInlineAsm() &&
+           !isa<Function>(call->getCalledOperand()->stripPointerCasts());
+  }
+
+  /// 参数或者返回值的类型无法转换时（比如结构体按值传递）不改写这个调用点
+  static bool canPromote(CallInst *call,
+                         const std::vector<Function *> &callees) {
+    for (Function *callee : callees) {
+      const char *reason = nullptr;
+      if (!isLegalToPromote(*call, callee, &reason)) {
+        LOG_INFO(LogCall, "Cannot devirtualize call at "
+                              << getLocation(call) << " to "
+                              << callee->getName() << ": " << reason);
+        return false;
+      }
+    }
+    return true;
+  }
+
+  static std::string getLocation(CallInst *call) {
+    const DebugLoc &loc = call->getDebugLoc();
+    return loc ? call->getFunction()->getName().str() + ":" +
+                     std::to_string(loc.getLine())
+               : call->getFunction()->getName().str();
+  }
+};
+
+#endif // DEVIRTUALIZE_H
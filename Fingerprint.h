@@ -0,0 +1,53 @@
+#ifndef FINGERPRINT_H
+#define FINGERPRINT_H
+
+#include <llvm/Support/CommandLine.h>
+#include <cstdint>
+
+using namespace llvm;
+
+// 打开后只比较指纹，不再做深比较。128 位指纹发生碰撞的概率可以忽略不计，
+// 但为了保险起见默认还是会在指纹相同时再做一次完整比较。
+static cl::opt<bool> TrustFingerprint(
+    "trust-fingerprint",
+    cl::desc("Treat equal state fingerprints as equal states (no deep compare)"),
+    cl::init(false));
+
+///
+/// 数据流状态的 128 位指纹
+///
+/// 每一个 (标签, 键, 元素) 三元组被散列成两个 64 位的值并异或进指纹里，
+/// 插入和删除是同一个操作，因此可以随着状态的修改增量维护，与插入顺序无关。
+/// 状态内部必须保证同一个三元组不会被重复计入（集合语义天然满足）。
+///
+struct Fingerprint {
+  uint64_t lo = 0;
+  uint64_t hi = 0;
+
+  void toggle(uint64_t tag, const void *key, const void *elem) {
+    uint64_t k = reinterpret_cast<uintptr_t>(key);
+    uint64_t e = reinterpret_cast<uintptr_t>(elem);
+    lo ^= mix(mix(k ^ (tag * 0x9e3779b97f4a7c15ULL)) ^ e);
+    hi ^= mix(mix(e + 0xc2b2ae3d27d4eb4fULL) ^ (k * 0x165667b19e3779f9ULL) ^
+              tag);
+  }
+
+  bool operator==(const Fingerprint &fp) const {
+    return lo == fp.lo && hi == fp.hi;
+  }
+
+  bool operator!=(const Fingerprint &fp) const { return !(*this == fp); }
+
+private:
+  // splitmix64 的终结函数
+  static uint64_t mix(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+  }
+};
+
+#endif // FINGERPRINT_H
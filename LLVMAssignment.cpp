@@ -16,7 +16,11 @@
 #include <llvm/IR/LegacyPassManager.h>
 #include <llvm/IRReader/IRReader.h>
 #include <llvm/Support/CommandLine.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
 #include <llvm/Support/SourceMgr.h>
+#include <llvm/Support/ThreadPool.h>
 #include <llvm/Support/ToolOutputFile.h>
 
 #include <llvm/Bitcode/BitcodeReader.h>
@@ -29,7 +33,11 @@
 #include <llvm/Pass.h>
 #include <llvm/Support/raw_ostream.h>
 
+#include "CrossModuleImporter.h"
+#include "Devirtualize.h"
 #include "PointToAnalysis.h"
+#include "QueryServer.h"
+#include "Statistics.h"
 
 using namespace llvm;
 static ManagedStatic<LLVMContext> GlobalContext;
@@ -53,28 +61,325 @@ static RegisterPass<PointToAnalysis> X("point-to", "Point-to Analysis Pass",
                                        false, false);
 
 static cl::opt<std::string>
-    InputFilename(cl::Positional, cl::desc("<filename>.bc"), cl::init(""));
+    InputFilename(cl::Positional,
+                  cl::desc("<filename>.bc or a directory of .bc files"),
+                  cl::init(""));
 
-int main(int argc, char **argv) {
+static cl::opt<bool> LazyLoad(
+    "lazy", cl::desc("Load function bodies only when the analysis reaches them"),
+    cl::init(false));
+
+static cl::opt<std::string>
+    InputList("input-list",
+              cl::desc("Analyze every file listed in <file>, one per line"),
+              cl::value_desc("file"), cl::init(""));
+
+static cl::opt<unsigned>
+    Jobs("j", cl::desc("Number of modules analyzed in parallel in batch mode, "
+                       "or requests handled in parallel in server mode "
+                       "(0 = number of hardware threads)"),
+         cl::Prefix, cl::init(0));
+
+static cl::list<std::string> LinkModules(
+    "link-modules",
+    cl::desc("Other modules of the program, function bodies are imported from "
+             "them when the analysis reaches a declaration (comma separated)"),
+    cl::value_desc("files"), cl::CommaSeparated);
+
+static cl::opt<std::string>
+    DumpSnapshot("dump-snapshot",
+                 cl::desc("Print the contents of a result snapshot and exit"),
+                 cl::value_desc("file"), cl::init(""));
+
+static cl::opt<std::string> ServeSocket(
+    "serve",
+    cl::desc("Analyze the module once and answer queries on this Unix domain "
+             "socket until a shutdown request arrives"),
+    cl::value_desc("socket"), cl::init(""));
+
+static std::unique_ptr<Module> loadModule(StringRef Filename, SMDiagnostic &Err,
+                                          LLVMContext &Context) {
+  PhaseTimer Timer("parse");
+  return LazyLoad ? getLazyIRFileModule(Filename, Err, Context)
+                  : parseIRFile(Filename, Err, Context);
+}
+
+/// 给出 -devirtualize 时按分析结果改写间接调用，把模块写成 bitcode
+static bool devirtualize(Module &M, const PointToAnalysis &Analysis) {
+  if (DevirtualizeOutput.empty()) {
+    return true;
+  }
+  // 只有所有可能从外部进入的函数都分析过，唯一的被调函数才能不加检查地直接调用
+  bool Complete = DevirtUnguarded && WholeModule && EntryFunctions.empty();
+  Devirtualizer::Result Result = Devirtualizer::run(
+      Analysis.getCallTargets(), Analysis.getOpenCalls(), Complete);
+  errs() << "Devirtualized " << Result.direct + Result.guarded
+         << " indirect call(s): " << Result.direct << " direct, "
+         << Result.guarded << " guarded, " << Result.skipped << " skipped\n";
+  return Devirtualizer::write(M, DevirtualizeOutput, errs());
+}
+
+/// 对读入的模块运行 mem2reg 和指向分析，结果写到 out，
+/// snapshotData 不为空时同时把结果快照的内容写到 snapshotData。
+/// 返回 false 表示 -devirtualize 的结果没能写出
+static bool runAnalysis(Module &M, raw_ostream &out,
+                        std::string *snapshotData = nullptr) {
+  // 其他模块只建立符号表，函数体在分析到达对应的声明时才导入
+  std::unique_ptr<CrossModuleImporter> Importer;
+  if (!LinkModules.empty()) {
+    Importer.reset(new CrossModuleImporter(M));
+    for (const std::string &Filename : LinkModules) {
+      Importer->addModule(Filename, errs());
+    }
+  }
+
+  if (!LazyLoad && !Importer) {
+    {
+      PhaseTimer Timer("mem2reg");
+      llvm::legacy::PassManager Passes;
+#if LLVM_VERSION_MAJOR == 5
+      Passes.add(new EnableFunctionOptPass());
+#endif
+      /// Transform it to SSA
+      Passes.add(llvm::createPromoteMemoryToRegisterPass());
+      Passes.run(M);
+    }
+
+    llvm::legacy::PassManager Passes;
+    PointToAnalysis *Analysis = new PointToAnalysis(out);
+    Analysis->setSnapshotOutput(snapshotData);
+    Passes.add(Analysis);
+    Passes.run(M);
+    return devirtualize(M, *Analysis);
+  }
+
+  // 懒加载的函数体在分析第一次到达时才读入，导入的函数体在到达声明时才链接进来，
+  // mem2reg 也只在这时对这一个函数运行
+  legacy::FunctionPassManager FunctionPasses(&M);
+  FunctionPasses.add(llvm::createPromoteMemoryToRegisterPass());
+  FunctionPasses.doInitialization();
+
+  if (!LazyLoad) {
+    PhaseTimer Timer("mem2reg");
+    llvm::legacy::PassManager Passes;
+    Passes.add(llvm::createPromoteMemoryToRegisterPass());
+    Passes.run(M);
+  }
+
+  llvm::legacy::PassManager Passes;
+  PointToAnalysis *Analysis =
+      new PointToAnalysis(out, [&FunctionPasses, &Importer](Function *F) {
+        if (F->isMaterializable()) {
+          if (Error E = F->materialize()) {
+            logAllUnhandledErrors(std::move(E), errs(), F->getName() + ": ");
+            return;
+          }
+        } else if (!Importer || !Importer->import(F)) {
+          return;
+        }
+        PhaseTimer Timer("mem2reg");
+        FunctionPasses.run(*F);
+      });
+  Analysis->setSnapshotOutput(snapshotData);
+  Passes.add(Analysis);
+  Passes.run(M);
+  bool Written = devirtualize(M, *Analysis);
+  FunctionPasses.doFinalization();
+  return Written;
+}
+
+/// 批处理模式的输入：-input-list 给出的文件列表，或者目录下所有的 .bc 文件
+static bool collectBatchInputs(std::vector<std::string> &Files) {
+  if (!InputList.empty()) {
+    auto Buffer = MemoryBuffer::getFile(InputList);
+    if (!Buffer) {
+      errs() << InputList << ": " << Buffer.getError().message() << "\n";
+      return false;
+    }
+    SmallVector<StringRef, 64> Lines;
+    (*Buffer)->getBuffer().split(Lines, '\n', -1, false);
+    for (StringRef Line : Lines) {
+      Line = Line.trim();
+      if (!Line.empty()) {
+        Files.push_back(Line.str());
+      }
+    }
+    return true;
+  }
+
+  std::error_code EC;
+  for (sys::fs::directory_iterator I(InputFilename, EC), E; I != E && !EC;
+       I.increment(EC)) {
+    if (sys::path::extension(I->path()) == ".bc") {
+      Files.push_back(I->path());
+    }
+  }
+  if (EC) {
+    errs() << InputFilename << ": " << EC.message() << "\n";
+    return false;
+  }
+  std::sort(Files.begin(), Files.end());
+  return true;
+}
+
+///
+/// 批处理模式：在一个进程中分析多个模块
+///
+/// 每个任务在自己的 LLVMContext 中读入并分析一个模块，线程池的大小限制了同时在内存中的
+/// 模块个数，一个模块分析的同时其他线程已经在读入后面的模块。结果先写到字符串里，
+/// 按输入顺序尽早输出，保证输出与单线程运行时相同。
+///
+static int runBatch() {
+  std::vector<std::string> Files;
+  if (!collectBatchInputs(Files)) {
+    return 1;
+  }
+
+  ResultWriter::writeStreamHeader(ResultFormat, outs());
+  std::vector<std::string> Outputs(Files.size());
+  std::vector<bool> Finished(Files.size(), false);
+  size_t NextToPrint = 0;
+  bool Failed = false;
+  std::mutex OutputMutex;
+
+  ThreadPool Pool(hardware_concurrency(Jobs));
+  for (size_t I = 0; I < Files.size(); I++) {
+    Pool.async([&, I]() {
+      LLVMContext Context;
+      SMDiagnostic Err;
+      std::string Output;
+      raw_string_ostream Out(Output);
+      ResultWriter::writeModuleHeader(ResultFormat, Out, Files[I]);
+
+      // 结构化的输出中不能混入错误信息，错误写到错误输出
+      std::string Errors;
+      raw_string_ostream ErrOut(Errors);
+      std::unique_ptr<Module> M = loadModule(Files[I], Err, Context);
+      bool Loaded = M != nullptr;
+      if (Loaded) {
+        runAnalysis(*M, Out);
+      } else {
+        Err.print(Files[I].c_str(),
+                  ResultFormat == OutputFormat::Text ? Out : ErrOut);
+      }
+      Out.flush();
+      ErrOut.flush();
+
+      std::lock_guard<std::mutex> Lock(OutputMutex);
+      errs() << Errors;
+      Failed |= !Loaded;
+      Outputs[I] = std::move(Output);
+      Finished[I] = true;
+      for (; NextToPrint < Files.size() && Finished[NextToPrint];
+           NextToPrint++) {
+        outs() << Outputs[NextToPrint];
+        outs().flush();
+        Outputs[NextToPrint].clear();
+      }
+    });
+  }
+  Pool.wait();
+  return Failed ? 1 : 0;
+}
+
+///
+/// 查询服务模式：每次（重新）分析都在新的 LLVMContext 中读入模块，
+/// 分析结果转成快照以后模块就释放掉，查询只访问快照。
+/// 重新分析通过摘要缓存文件复用没有变化的函数的结果
+///
+static int runServer() {
+  if (SummaryCachePath.empty()) {
+    SummaryCachePath = ServeSocket + ".ptsum";
+  }
+  SnapshotPointsTo = true;
+
+  QueryServer Server(
+      [](raw_ostream &Err) -> std::unique_ptr<ResultSnapshot> {
+        LLVMContext Context;
+        SMDiagnostic Diag;
+        std::unique_ptr<Module> M = loadModule(InputFilename, Diag, Context);
+        if (!M) {
+          Diag.print(InputFilename.c_str(), Err);
+          return nullptr;
+        }
+        std::string Output, Snapshot;
+        raw_string_ostream Out(Output);
+        runAnalysis(*M, Out, &Snapshot);
+        return ResultSnapshot::create(
+            MemoryBuffer::getMemBufferCopy(Snapshot, InputFilename));
+      },
+      hardware_concurrency(Jobs));
+  return Server.run(ServeSocket, errs()) ? 0 : 1;
+}
+
+/// 分析单个模块，结果写到错误输出（结构化的格式写到标准输出）
+static int runSingleModule(const char *Argv0) {
   LLVMContext &Context = getGlobalContext();
   SMDiagnostic Err;
-  // Parse the command line to read the Inputfilename
-  cl::ParseCommandLineOptions(argc, argv, "Point-to analysis.\n");
 
   // Load the input module
-  std::unique_ptr<Module> M = parseIRFile(InputFilename, Err, Context);
+  std::unique_ptr<Module> M = loadModule(InputFilename, Err, Context);
   if (!M) {
-    Err.print(argv[0], errs());
+    Err.print(Argv0, errs());
     return 1;
   }
 
-  llvm::legacy::PassManager Passes;
-#if LLVM_VERSION_MAJOR == 5
-  Passes.add(new EnableFunctionOptPass());
-#endif
-  /// Transform it to SSA
-  Passes.add(llvm::createPromoteMemoryToRegisterPass());
+  // 结构化的结果是给其他程序读的，写到标准输出，不与调试信息混在一起
+  ResultWriter::writeStreamHeader(ResultFormat, outs());
+  if (!runAnalysis(*M, ResultFormat == OutputFormat::Text ? errs() : outs())) {
+    return 1;
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  // Parse the command line to read the Inputfilename
+  cl::ParseCommandLineOptions(argc, argv, "Point-to analysis.\n");
+
+  if (!DumpSnapshot.empty()) {
+    std::unique_ptr<ResultSnapshot> Snapshot =
+        ResultSnapshot::open(DumpSnapshot, errs());
+    if (!Snapshot) {
+      return 1;
+    }
+    Snapshot->print(outs());
+    return 0;
+  }
+
+  bool Batch = !InputList.empty() || sys::fs::is_directory(InputFilename);
+  if (!DevirtualizeOutput.empty() && (Batch || !ServeSocket.empty())) {
+    errs() << "-devirtualize only works on a single module\n";
+    return 1;
+  }
+  // 导入的函数体和局部符号的副本会随模块一起写出，
+  // 改写后的模块与其他模块链接时会重复定义
+  if (!DevirtualizeOutput.empty() && !LinkModules.empty()) {
+    errs() << "-devirtualize cannot be combined with -link-modules\n";
+    return 1;
+  }
+  // 批量分析时各个模块并行地写缓存和快照，共用一个文件会互相覆盖
+  if (Batch && !SummaryCachePath.empty() &&
+      !sys::fs::is_directory(SummaryCachePath)) {
+    errs() << "-summary-cache must be a directory when analyzing several "
+              "modules\n";
+    return 1;
+  }
+  if (Batch && !SnapshotPath.empty() && !sys::fs::is_directory(SnapshotPath)) {
+    errs() << "-snapshot must be a directory when analyzing several modules\n";
+    return 1;
+  }
 
-  Passes.add(new PointToAnalysis());
-  Passes.run(*M.get());
+  int Result;
+  if (!ServeSocket.empty()) {
+    Result = runServer();
+  } else if (Batch) {
+    Result = runBatch();
+  } else {
+    Result = runSingleModule(argv[0]);
+  }
+
+  if (isStatsEnabled() && !StatsReport::get().write(errs())) {
+    Result = 1;
+  }
+  return Result;
 }
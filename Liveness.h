@@ -18,21 +18,41 @@
 #include <llvm/Support/raw_ostream.h>
 
 #include "Dataflow.h"
+#include "Fingerprint.h"
 using namespace llvm;
 
 struct LivenessInfo {
+private:
   std::set<Instruction *> LiveVars; /// Set of variables which are live
+  Fingerprint fingerprint;          /// Maintained by insert/erase
+
+public:
   LivenessInfo() : LiveVars() {}
-  LivenessInfo(const LivenessInfo &info) : LiveVars(info.LiveVars) {}
+  LivenessInfo(const LivenessInfo &info)
+      : LiveVars(info.LiveVars), fingerprint(info.fingerprint) {}
 
   bool operator==(const LivenessInfo &info) const {
-    return LiveVars == info.LiveVars;
+    if (fingerprint != info.fingerprint)
+      return false;
+    return TrustFingerprint || LiveVars == info.LiveVars;
+  }
+
+  const std::set<Instruction *> &getLiveVars() const { return LiveVars; }
+
+  void insert(Instruction *inst) {
+    if (LiveVars.insert(inst).second)
+      fingerprint.toggle(0, inst, nullptr);
+  }
+
+  void erase(Instruction *inst) {
+    if (LiveVars.erase(inst))
+      fingerprint.toggle(0, inst, nullptr);
   }
 };
 
 inline raw_ostream &operator<<(raw_ostream &out, const LivenessInfo &info) {
-  for (std::set<Instruction *>::iterator ii = info.LiveVars.begin(),
-                                         ie = info.LiveVars.end();
+  for (std::set<Instruction *>::const_iterator ii = info.getLiveVars().begin(),
+                                               ie = info.getLiveVars().end();
        ii != ie; ++ii) {
     const Instruction *inst = *ii;
     out << inst->getName();
@@ -45,22 +65,22 @@ class LivenessVisitor : public DataflowVisitor<struct LivenessInfo> {
 public:
   LivenessVisitor() {}
   void merge(LivenessInfo *dest, const LivenessInfo &src) override {
-    for (std::set<Instruction *>::const_iterator ii = src.LiveVars.begin(),
-                                                 ie = src.LiveVars.end();
+    for (std::set<Instruction *>::const_iterator ii = src.getLiveVars().begin(),
+                                                 ie = src.getLiveVars().end();
          ii != ie; ++ii) {
-      dest->LiveVars.insert(*ii);
+      dest->insert(*ii);
     }
   }
 
   void compDFVal(Instruction *inst, LivenessInfo *dfval) override {
     if (isa<DbgInfoIntrinsic>(inst))
       return;
-    dfval->LiveVars.erase(inst);
+    dfval->erase(inst);
     for (User::op_iterator oi = inst->op_begin(), oe = inst->op_end(); oi != oe;
          ++oi) {
       Value *val = *oi;
       if (isa<Instruction>(val))
-        dfval->LiveVars.insert(cast<Instruction>(val));
+        dfval->insert(cast<Instruction>(val));
     }
   }
 };
@@ -0,0 +1,239 @@
+#ifndef MOD_REF_SUMMARY_H
+#define MOD_REF_SUMMARY_H
+
+#include <llvm/ADT/BitVector.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/Support/raw_ostream.h>
+#include <algorithm>
+#include <map>
+#include <vector>
+
+using namespace llvm;
+
+///
+/// 由指向分析的结果得到的过程间读写摘要
+///
+/// 指向集中出现的抽象对象（局部变量、全局变量等）统一编号，每个函数和每个调用点可能
+/// 读写的对象集合都用以编号为下标的位向量保存。函数的集合包含它调用的函数的读写，
+/// 但不包含它自己的局部变量；调用点的集合就是被调函数在这里可能产生的读写。
+/// 多个调用上下文的结果合并在一起。
+///
+class ModRefSummary {
+public:
+  enum ModRefKind : unsigned char {
+    NoModRef = 0,
+    Ref = 1,
+    Mod = 2,
+    ModRef = 3
+  };
+
+  static const unsigned NoObject = ~0U;
+
+  /// 记录 func 中的一条指令读或写了对象 object
+  void addAccess(Function *func, Value *object, ModRefKind kind) {
+    if (isa<ConstantData>(object) || isLocalTo(object, func)) {
+      return;
+    }
+    unsigned id = getOrCreateId(object);
+    add(functions[func], id, kind);
+  }
+
+  /// 被调函数 callee 的分析完成后，把它的读写并入调用点和调用者
+  /// @return 调用点或者调用者的集合是否发生了变化
+  bool addCallSite(CallInst *call, Function *callee) {
+    auto calleeSets = functions.find(callee);
+    if (calleeSets == functions.end()) {
+      callSites[call]; // 调用点存在但没有读写
+      return false;
+    }
+    // 先拷贝一份，下面的插入可能让迭代器失效
+    Sets calleeCopy = calleeSets->second;
+    Sets &site = callSites[call];
+    bool changed = add(site, calleeCopy);
+
+    Function *caller = call->getFunction();
+    Sets &callerSets = functions[caller];
+    for (unsigned id : calleeCopy.mod.set_bits()) {
+      if (!isLocalTo(objects[id], caller)) {
+        changed |= add(callerSets, id, Mod);
+      }
+    }
+    for (unsigned id : calleeCopy.ref.set_bits()) {
+      if (!isLocalTo(objects[id], caller)) {
+        changed |= add(callerSets, id, Ref);
+      }
+    }
+    return changed;
+  }
+
+  unsigned getNumObjects() const { return objects.size(); }
+
+  Value *getObject(unsigned id) const { return objects[id]; }
+
+  /// 对象的编号，从来没有被读写过的对象返回 NoObject
+  unsigned getObjectId(const Value *object) const {
+    auto iter = ids.find(object);
+    return iter == ids.end() ? NoObject : iter->second;
+  }
+
+  ModRefKind getModRef(const Function *func, const Value *object) const {
+    return lookup(functions, func, object);
+  }
+
+  ModRefKind getModRef(const CallInst *call, const Value *object) const {
+    return lookup(callSites, call, object);
+  }
+
+  bool mayModify(const CallInst *call, const Value *object) const {
+    return getModRef(call, object) & Mod;
+  }
+
+  bool mayReference(const CallInst *call, const Value *object) const {
+    return getModRef(call, object) & Ref;
+  }
+
+  /// 函数可能写的对象集合，位下标是对象编号，没有分析过的函数返回空集合
+  const BitVector &getModSet(const Function *func) const {
+    return getSets(functions, func).mod;
+  }
+
+  const BitVector &getRefSet(const Function *func) const {
+    return getSets(functions, func).ref;
+  }
+
+  const BitVector &getModSet(const CallInst *call) const {
+    return getSets(callSites, call).mod;
+  }
+
+  const BitVector &getRefSet(const CallInst *call) const {
+    return getSets(callSites, call).ref;
+  }
+
+  /// 调用点是否被分析过，没有分析过的调用点不能据此判断它不读写任何对象
+  bool hasCallSite(const CallInst *call) const {
+    return callSites.find(call) != callSites.end();
+  }
+
+  // Example:
+  // moo:
+  //         mod: {%a_fptr, %m_fptr}
+  //         ref: {%a_fptr}
+  void print(raw_ostream &out) const {
+    // 按函数名排序，保证每次运行的输出顺序相同
+    std::vector<std::pair<StringRef, const Sets *>> sorted;
+    for (const auto &entry : functions) {
+      sorted.push_back(std::make_pair(entry.first->getName(), &entry.second));
+    }
+    std::sort(sorted.begin(), sorted.end());
+    for (const auto &entry : sorted) {
+      out << entry.first << ":\n";
+      out << "\tmod: ";
+      printSet(out, entry.second->mod);
+      out << "\n\tref: ";
+      printSet(out, entry.second->ref);
+      out << "\n";
+    }
+  }
+
+private:
+  struct Sets {
+    BitVector mod;
+    BitVector ref;
+  };
+
+  DenseMap<const Value *, unsigned> ids;
+  std::vector<Value *> objects;
+  std::map<const Function *, Sets> functions;
+  DenseMap<const CallInst *, Sets> callSites;
+
+  static bool isLocalTo(const Value *object, const Function *func) {
+    const AllocaInst *alloca = dyn_cast<AllocaInst>(object);
+    return alloca && alloca->getFunction() == func;
+  }
+
+  unsigned getOrCreateId(Value *object) {
+    auto result = ids.insert(std::make_pair(object, (unsigned)objects.size()));
+    if (result.second) {
+      objects.push_back(object);
+    }
+    return result.first->second;
+  }
+
+  /// @return 集合是否发生了变化
+  static bool add(Sets &sets, unsigned id, unsigned char kind) {
+    bool changed = false;
+    BitVector *targets[] = {(kind & Mod) ? &sets.mod : nullptr,
+                            (kind & Ref) ? &sets.ref : nullptr};
+    for (BitVector *bits : targets) {
+      if (!bits) {
+        continue;
+      }
+      if (bits->size() <= id) {
+        bits->resize(id + 1);
+      }
+      changed |= !bits->test(id);
+      bits->set(id);
+    }
+    return changed;
+  }
+
+  static bool add(Sets &sets, const Sets &other) {
+    bool changed = false;
+    for (unsigned id : other.mod.set_bits()) {
+      changed |= add(sets, id, Mod);
+    }
+    for (unsigned id : other.ref.set_bits()) {
+      changed |= add(sets, id, Ref);
+    }
+    return changed;
+  }
+
+  template <class Map, class Key>
+  static const Sets &getSets(const Map &map, const Key *key) {
+    static const Sets empty;
+    auto iter = map.find(key);
+    return iter == map.end() ? empty : iter->second;
+  }
+
+  template <class Map, class Key>
+  ModRefKind lookup(const Map &map, const Key *key,
+                    const Value *object) const {
+    unsigned id = getObjectId(object);
+    if (id == NoObject) {
+      return NoModRef;
+    }
+    const Sets &sets = getSets(map, key);
+    unsigned char kind = NoModRef;
+    if (sets.mod.size() > id && sets.mod.test(id)) {
+      kind |= Mod;
+    }
+    if (sets.ref.size() > id && sets.ref.test(id)) {
+      kind |= Ref;
+    }
+    return static_cast<ModRefKind>(kind);
+  }
+
+  void printSet(raw_ostream &out, const BitVector &bits) const {
+    out << "{";
+    bool first = true;
+    for (unsigned id : bits.set_bits()) {
+      if (!first) {
+        out << ", ";
+      }
+      first = false;
+      Value *object = objects[id];
+      out << (isa<GlobalValue>(object) ? "@" : "%");
+      if (object->hasName()) {
+        out << object->getName();
+      } else {
+        out << "*";
+      }
+    }
+    out << "}";
+  }
+};
+
+#endif // MOD_REF_SUMMARY_H
@@ -1,82 +1,301 @@
 #ifndef POINT_TO_ANALYSIS_H
 #define POINT_TO_ANALYSIS_H
 
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/Optional.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/Module.h"
 #include "llvm/Pass.h"
 #include "llvm/Support/raw_ostream.h"
+#include <functional>
 #include <llvm/IR/IntrinsicInst.h>
 
+#include "AddressTakenIndex.h"
+#include "Arena.h"
+#include "ArgModRef.h"
+#include "Budget.h"
 #include "Dataflow.h"
+#include "Fingerprint.h"
+#include "ModRefSummary.h"
+#include "Reachability.h"
+#include "ResultSnapshot.h"
+#include "ResultWriter.h"
+#include "Statistics.h"
+#include "TraceWriter.h"
+#include "SummaryStore.h"
 #include "utils.h"
 
 using namespace llvm;
 
 namespace {
 
+// 状态中的集合都分配在当前分析的内存池上，见 Arena.h
+typedef std::set<Value *, std::less<Value *>, ArenaAllocator<Value *>> ValueSet;
+typedef std::map<Value *, ValueSet, std::less<Value *>,
+                 std::scoped_allocator_adaptor<
+                     ArenaAllocator<std::pair<Value *const, ValueSet>>>>
+    ValueSetMap;
+typedef std::map<Value *, Value *, std::less<Value *>,
+                 ArenaAllocator<std::pair<Value *const, Value *>>>
+    AliasMap;
+
 // 注意：PointToSets没有全局的实体，都是作为临时变量和参数存在
 struct PointToSets {
+private:
   // 需要确保这两个map的key是互不相交的
   // 需要注意这俩map虽然形式一样但存储的内容是不同的
   // pointToSets: 一个变量它指向什么
   // binding: 一个变量它等同于什么，可以理解为别名
-  std::map<Value *, std::set<Value *>> pointToSets;
-  std::map<Value *, std::set<Value *>> bindings; // 存储临时变量绑定关系
+  ValueSetMap pointToSets;
+  ValueSetMap bindings; // 存储临时变量绑定关系
+
+  // 单一目标的纯别名（比如GEP的结果等同于它的基址）不放进bindings，
+  // 而是记录一条指向被转发对象的边，查询时沿着边找到根。
+  // 边就是指令的操作数，同一个值在任何状态中的边都相同，合并状态时取并集即可；
+  // 别名链的长度就是GEP的嵌套层数，很短，所以不做路径压缩。
+  // aliases的key与上面两个map的key也是互不相交的
+  AliasMap aliases;
+
+  // pointToSets构成的指向图上的可达性索引，第一次查询时建立，之后在状态的拷贝之间共享。
+  // reachDirty记录索引建立以后指向集发生变化的值，下次查询时据此增量更新索引
+  mutable std::shared_ptr<const ReachabilityIndex> reachIndex;
+  mutable SmallVector<Value *, 8> reachDirty;
 
+  // 随每次修改增量更新的指纹，用于不动点迭代中快速判断状态是否改变
+  // 因此上面两个map只能通过成员函数修改
+  Fingerprint fingerprint;
+
+  // 指纹中区分不同种类条目的标签
+  enum : uint64_t { PTSKey, PTSElem, BindingKey, BindingElem, AliasEdge };
+
+public:
   friend raw_ostream &operator<<(raw_ostream &out, const PointToSets &pts);
 
   bool operator==(const PointToSets &pts) const {
-    return pointToSets == pts.pointToSets && bindings == pts.bindings;
+    if (fingerprint != pts.fingerprint) {
+      return false;
+    }
+    return TrustFingerprint ||
+           (pointToSets == pts.pointToSets && bindings == pts.bindings &&
+            aliases == pts.aliases);
+  }
+
+  bool operator!=(const PointToSets &pts) const { return !(*this == pts); }
+
+  const Fingerprint &getFingerprint() const { return fingerprint; }
+
+  // 只读的原始数据，用于把状态写进摘要缓存
+  const ValueSetMap &getPointToSets() const { return pointToSets; }
+  const ValueSetMap &getBindings() const { return bindings; }
+  const AliasMap &getAliases() const { return aliases; }
+
+  /// 状态的大小：所有指向集和绑定中元素的个数加上别名边的条数，用于统计
+  size_t size() const {
+    size_t result = aliases.size();
+    for (const auto &entry : pointToSets) {
+      result += entry.second.size();
+    }
+    for (const auto &entry : bindings) {
+      result += entry.second.size();
+    }
+    return result;
   }
 
-  bool operator!=(const PointToSets &pts) const {
-    return pointToSets != pts.pointToSets || bindings != pts.bindings;
+  /// 记录 value 是 target 的纯别名，value 必须是还没有绑定的临时变量。
+  /// 记录的是到 target 本身的边，而不是到 target 当时的根的边
+  void setAlias(Value *value, Value *target) {
+    // 不可达的代码中可能出现 %a = gep %a 这样的环
+    if (resolveAlias(target) == value) {
+      return;
+    }
+    assert(!hasBinding(value));
+    auto iter = aliases.lower_bound(value);
+    if (iter != aliases.end() && iter->first == value) {
+      assert(iter->second == target && "alias edges come from SSA operands");
+      return;
+    }
+    aliases.emplace_hint(iter, value, target);
+    fingerprint.toggle(AliasEdge, value, target);
+  }
+
+  /// 沿着别名边找到 value 最终等同的值
+  Value *resolveAlias(Value *value) const {
+    for (auto iter = aliases.find(value); iter != aliases.end();
+         iter = aliases.find(value)) {
+      value = iter->second;
+    }
+    return value;
+  }
+
+  ///
+  /// 把指针操作数解析为它实际代表的目标：先经过别名找到根，根有绑定时依次访问绑定的
+  /// 每一个值，否则根本身就是唯一的目标。
+  /// @return 目标的个数
+  ///
+  template <class Fn> size_t forEachTarget(Value *value, Fn fn) const {
+    Value *root = resolveAlias(value);
+    auto iter = bindings.find(root);
+    if (iter == bindings.end()) {
+      fn(root);
+      return 1;
+    }
+    for (Value *v : iter->second) {
+      fn(v);
+    }
+    return iter->second.size();
   }
 
-  bool hasBinding(Value *value) {
+  bool hasBinding(Value *value) const {
     return bindings.find(value) != bindings.end();
   }
 
-  void setBinding(Value *pointer, std::set<Value *> values) {
-    bindings[pointer] = values;
+  /// 只读视图，绑定不存在时返回空集合
+  const ValueSet &getBinding(Value *tmp) const {
+    auto iter = bindings.find(tmp);
+    return iter == bindings.end() ? emptySet() : iter->second;
+  }
+
+  void setBinding(Value *pointer, ValueSet values) {
+    assign(slot(bindings, pointer, BindingKey), std::move(values), pointer,
+           BindingElem);
   }
 
-  std::set<Value *> getBinding(Value *tmp) {
-    // assert(hasBinding(tmp));
-    return bindings[tmp];
+  void addBinding(Value *pointer, const ValueSet &values) {
+    unite(slot(bindings, pointer, BindingKey), values, pointer, BindingElem);
   }
 
-  bool hasPTS(Value *pointer) {
+  bool hasPTS(Value *pointer) const {
     return pointToSets.find(pointer) != pointToSets.end();
   }
 
-  /// TODO: 这个函数或许可以优化一下
-  /// 最好是去掉自动查找binding的部分，不然会让后面的部分难以理解
-  /// 可能会分不清数据到底是从哪里来的
-  std::set<Value *> getPTS(Value *pointer) {
+  /// 只读视图，只查找 pointer 自己的指向集，不会经过绑定，不存在时返回空集合
+  const ValueSet &getPTS(Value *pointer) const {
+    auto iter = pointToSets.find(pointer);
+    return iter == pointToSets.end() ? emptySet() : iter->second;
+  }
+
+  /// 对 pointer 指向的每一个值调用 fn，如果 pointer 有绑定，则先经过绑定再查指向集，
+  /// 这种情况下同一个值可能被访问多次
+  template <class Fn> void forEachPTS(Value *pointer, Fn fn) const {
+    pointer = resolveAlias(pointer);
     auto tmp = bindings.find(pointer);
-    if (tmp != bindings.end()) {
-      std::set<Value *> result;
-      // LOG_DEBUG("Found binding for: " << *(tmp->first));
-      for (Value *v : tmp->second) {
-        // LOG_DEBUG("Binding target: " << *v);
-        // std::set<Value *> &pts = pointToSets.at(v);
-        if (pointToSets.find(v) == pointToSets.end()) {
-          LOG_DEBUG("Warn: Empty pts for binding target " << *v);
-        }
-        std::set<Value *> &pts = pointToSets[v];
-        result.insert(pts.begin(), pts.end());
+    if (tmp == bindings.end()) {
+      for (Value *v : getPTS(pointer)) {
+        fn(v);
       }
-      return result;
-    } else {
-      // LOG_DEBUG("Found in pts: " << *pointer);
-      return pointToSets.at(pointer);
+      return;
+    }
+    for (Value *target : tmp->second) {
+      if (!hasPTS(target)) {
+        LOG_DEBUG(LogTransfer,
+                  "Warn: Empty pts for binding target " << *target);
+      }
+      for (Value *v : getPTS(target)) {
+        fn(v);
+      }
+    }
+  }
+
+  /// 把 pointer 的指向集（经过绑定）并入 dest
+  void unionPTSInto(Value *pointer, ValueSet &dest) const {
+    forEachPTS(pointer, [&dest](Value *v) { dest.insert(v); });
+  }
+
+  void setPTS(Value *pointer, ValueSet set) {
+    assign(slot(pointToSets, pointer, PTSKey), std::move(set), pointer,
+           PTSElem);
+  }
+
+  void addPTS(Value *pointer, const ValueSet &set) {
+    unite(slot(pointToSets, pointer, PTSKey), set, pointer, PTSElem);
+  }
+
+  /// 取得指向图上的可达性索引，状态修改过的话会先增量更新
+  std::shared_ptr<const ReachabilityIndex> getReachability() const {
+    if (!reachIndex) {
+      reachIndex = std::make_shared<ReachabilityIndex>(pointToSets);
+    } else if (!reachDirty.empty()) {
+      reachIndex = std::make_shared<ReachabilityIndex>(pointToSets,
+                                                       *reachIndex, reachDirty);
     }
+    reachDirty.clear();
+    return reachIndex;
   }
 
-  void setPTS(Value *pointer, std::set<Value *> &set) {
-    pointToSets[pointer] = set;
+  /// 把 src 中的指向集、绑定和别名关系并入当前状态
+  /// 别名边都来自SSA定义，同一个值在不同状态中的别名边总是相同的，取并集不会冲突
+  void mergeFrom(const PointToSets &src) {
+    for (const auto &alias : src.aliases) {
+      setAlias(alias.first, alias.second);
+    }
+    for (const auto &pts : src.pointToSets) {
+      unite(slot(pointToSets, pts.first, PTSKey), pts.second, pts.first,
+            PTSElem);
+    }
+    for (const auto &binding : src.bindings) {
+      unite(slot(bindings, binding.first, BindingKey), binding.second,
+            binding.first, BindingElem);
+    }
+  }
+
+private:
+  // 取得key对应的集合，不存在时创建一个空集合并把这个新key计入指纹
+  ValueSet &slot(ValueSetMap &map, Value *key, uint64_t keyTag) {
+    auto iter = map.lower_bound(key);
+    if (iter == map.end() || iter->first != key) {
+      // 通过scoped_allocator_adaptor，新集合与map使用同一个内存池
+      iter = map.emplace_hint(iter, std::piecewise_construct,
+                              std::forward_as_tuple(key),
+                              std::forward_as_tuple());
+      fingerprint.toggle(keyTag, key, nullptr);
+    }
+    return iter->second;
+  }
+
+  void assign(ValueSet &dest, ValueSet &&src, Value *key, uint64_t elemTag) {
+    if (elemTag == PTSElem && reachIndex && dest != src) {
+      markReachDirty(key);
+    }
+    for (Value *v : dest) {
+      fingerprint.toggle(elemTag, key, v);
+    }
+    dest = std::move(src);
+    for (Value *v : dest) {
+      fingerprint.toggle(elemTag, key, v);
+    }
+  }
+
+  static const ValueSet &emptySet() {
+    static const ValueSet empty{ArenaAllocator<Value *>(nullptr)};
+    return empty;
+  }
+
+  void unite(ValueSet &dest, const ValueSet &src, Value *key,
+             uint64_t elemTag) {
+    bool changed = false;
+    for (Value *v : src) {
+      if (dest.insert(v).second) {
+        fingerprint.toggle(elemTag, key, v);
+        changed = true;
+      }
+    }
+    if (changed && elemTag == PTSElem) {
+      markReachDirty(key);
+    }
+  }
+
+  void markReachDirty(Value *key) {
+    if (!reachIndex) {
+      return;
+    }
+    // 变化太多时增量更新已经没有意义，直接丢掉索引
+    if (reachDirty.size() >= 32) {
+      reachIndex.reset();
+      reachDirty.clear();
+      return;
+    }
+    reachDirty.push_back(key);
   }
 };
 
@@ -84,7 +303,7 @@ struct PointToSets {
 //   {%a_fptr, %b_fptr, %*}
 //   {@plus, @minus}
 inline raw_ostream &operator<<(raw_ostream &out,
-                               const std::set<Value *> &setOfValues) {
+                               const ValueSet &setOfValues) {
   out << "{";
   for (auto iter = setOfValues.begin(); iter != setOfValues.end(); iter++) {
     if (iter != setOfValues.begin()) {
@@ -120,6 +339,8 @@ inline raw_ostream &operator<<(raw_ostream &out,
 //         %*= {%*}
 //         %*= {@plus}
 //         %*= {%*, %*, %*}
+// Temp value aliases:
+//         %sptr -> {%m_fptr}
 //         ......
 inline raw_ostream &operator<<(raw_ostream &out, const PointToSets &pts) {
   out << "Point-to sets: \n";
@@ -143,51 +364,615 @@ inline raw_ostream &operator<<(raw_ostream &out, const PointToSets &pts) {
     out << "= " << v.second << "\n";
   }
 
+  out << "Temp value aliases: \n";
+  for (const auto v : pts.aliases) {
+    out << "\t%";
+    if (v.first->hasName()) {
+      out << v.first->getName();
+    } else {
+      out << "*";
+    }
+    out << " -> " << ValueSet({v.second}) << "\n";
+  }
+
   return out;
 }
 
-class PointToVisitor : public DataflowVisitor<struct PointToSets> {
-public:
-  // 保存函数调用结果，即行号和对应被调用函数名的映射
-  std::map<unsigned, std::set<std::string>> functionCallResult;
+static cl::opt<bool> PruneCalleeState(
+    "prune-callee-state",
+    cl::desc("Only pass objects a callee may access into its entry state"),
+    cl::init(true));
+
+static cl::opt<bool> ReuseCallSummaries(
+    "reuse-call-summaries",
+    cl::desc("Reuse a callee's result when it is reached again with the same "
+             "entry state"),
+    cl::init(true));
+
+static cl::opt<bool> WholeModule(
+    "whole-module",
+    cl::desc("Analyze from main, every externally visible function and every "
+             "address-taken function instead of the last function"),
+    cl::init(false));
+
+static cl::list<std::string> EntryFunctions(
+    "entry", cl::desc("Analyze from the given functions (comma separated)"),
+    cl::CommaSeparated);
+
+static cl::opt<bool> PrintModRef(
+    "print-modref",
+    cl::desc("Print the mod/ref summary of every analyzed function"),
+    cl::init(false));
+
+static cl::opt<bool> FilterCalleeTypes(
+    "filter-callee-types",
+    cl::desc("Skip possible callees whose type cannot match the call (wrong "
+             "argument count or incompatible argument types)"),
+    cl::init(true));
+
+// 每个调用点可能调用的函数，没有解析出被调函数的调用点对应空集合
+typedef std::map<CallInst *, std::set<Function *>> CallTargetMap;
+
+///
+/// 分析过程中对读写摘要所做的修改，和调用结果一样随被调函数的摘要保存。
+/// 从缓存文件中复用摘要时没有重新分析，靠重放这些记录得到相同的读写摘要
+///
+struct ModRefLog {
+  std::set<std::tuple<Function *, Value *, unsigned char>> accesses;
+  std::set<std::pair<CallInst *, Function *>> callSites;
+
+  void merge(const ModRefLog &log) {
+    accesses.insert(log.accesses.begin(), log.accesses.end());
+    callSites.insert(log.callSites.begin(), log.callSites.end());
+  }
 
+  void replay(ModRefSummary &summary) const {
+    for (const auto &access : accesses) {
+      summary.addAccess(std::get<0>(access), std::get<1>(access),
+                        static_cast<ModRefSummary::ModRefKind>(
+                            std::get<2>(access)));
+    }
+    // 调用点的读写取决于被调函数当时的读写，记录中没有先后顺序，重复到不再变化为止
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (const auto &callSite : callSites) {
+        changed |= summary.addCallSite(callSite.first, callSite.second);
+      }
+    }
+  }
+};
+
+///
+/// 被调函数的分析摘要
+///
+/// 同一个函数在相同的入口状态下分析得到的出口状态和调用结果总是相同的，
+/// 第一次分析完成后记下来，之后从任何调用点、任何分析入口再遇到时都直接复用。
+/// 入口状态先按指纹分桶，桶内再逐个比较。
+///
+/// 打开了缓存文件时（-summary-cache），内存中找不到的摘要还会到文件中查找，
+/// 新的摘要也会写进文件。文件中的键由函数及其传递引用的函数的内容、分析选项和
+/// 入口状态共同决定，只要其中任何一个发生变化就不会命中。
+///
+class CallSummaryCache {
 public:
-  PointToVisitor() {}
+  struct Summary {
+    PointToSets entry;
+    PointToSets exit;
+    CallTargetMap callTargets;
+    ModRefLog modRefLog;
+    // 结果是近似的调用点，这样的摘要只在这次运行中复用，不写进缓存文件
+    std::set<CallInst *> degradedCalls;
+    // 被调函数可能不止分析结果中那些的调用点
+    std::set<CallInst *> openCalls;
+  };
+
+  /// 之后的查找和插入都会同时使用缓存文件
+  void attachStore(SummaryFile *file, ValueCodec *codec) {
+    this->file = file;
+    this->codec = codec;
+  }
 
-  void merge(PointToSets *dest, const PointToSets &src) override {
-    // 合并 pointToSets
-    auto &destSets = dest->pointToSets;
-    const auto &srcSets = src.pointToSets;
+  /// @param loaded 摘要是这次刚从缓存文件中读出来的，调用者需要重放其中的读写记录
+  const Summary *lookup(Function *func, const PointToSets &entry,
+                        bool *loaded) {
+    *loaded = false;
+    auto iter = summaries.find(makeKey(func, entry));
+    if (iter != summaries.end()) {
+      for (const auto &summary : iter->second) {
+        if (summary->entry == entry) {
+          return summary.get();
+        }
+      }
+    }
 
-    for (const auto &pts : srcSets) {
-      Value *k = pts.first; // 为啥不能用 const 修饰这个指针？？
-      const std::set<Value *> &s = pts.second;
+    MD5::MD5Result key;
+    StringRef payload;
+    if (!getStoreKey(func, entry, key) || !file->lookup(key, payload)) {
+      return nullptr;
+    }
+    // 旧记录中的值在模块里找不到、或者结果中的函数已经改变时当作没有命中
+    PointToSets exit;
+    CallTargetMap callTargets;
+    ModRefLog modRefLog;
+    std::set<CallInst *> openCalls;
+    SummaryReader reader(payload);
+    if (!decodeState(reader, exit) || !decodeCallTargets(reader, callTargets) ||
+        !decodeModRefLog(reader, modRefLog) ||
+        !decodeCalls(reader, openCalls) || !checkDependencies(reader) ||
+        reader.failed()) {
+      return nullptr;
+    }
+    *loaded = true;
+    return insertSummary(func, entry, exit, callTargets, modRefLog, {},
+                         openCalls);
+  }
 
-      auto result = destSets.find(k);
-      if (result == destSets.end()) {
-        destSets.insert(std::make_pair(k, s));
-      } else {
-        result->second.insert(s.begin(), s.end());
+  const Summary *insert(Function *func, const PointToSets &entry,
+                        const PointToSets &exit,
+                        const CallTargetMap &callTargets,
+                        const ModRefLog &modRefLog,
+                        const std::set<CallInst *> &degradedCalls,
+                        const std::set<CallInst *> &openCalls) {
+    MD5::MD5Result key;
+    if (degradedCalls.empty() && getStoreKey(func, entry, key)) {
+      // 出口状态、调用结果、读写记录、目标不完全的调用点、结果中出现的函数的键依次排列，
+      // 有值无法编码时不写入文件
+      std::string payload;
+      SummaryWriter writer(payload);
+      if (encodeState(exit, writer) && encodeCallTargets(callTargets, writer) &&
+          encodeModRefLog(modRefLog, writer) && encodeCalls(openCalls, writer) &&
+          encodeDependencies(exit, callTargets, writer)) {
+        file->insert(key, std::move(payload));
       }
     }
+    return insertSummary(func, entry, exit, callTargets, modRefLog,
+                         degradedCalls, openCalls);
+  }
 
-    // 合并 bindings
-    // 一般情况下绑定信息是不需要在基本块之间传递的，但是为了能够解决引用型参数和函数返回问题，
-    // 在这里也进行合并，不影响结果，但是可能会让调试信息更杂乱。
-    auto &destBindings = dest->bindings;
-    const auto &srcBindings = src.bindings;
+private:
+  typedef std::tuple<Function *, uint64_t, uint64_t> Key;
 
-    for (const auto &binding : srcBindings) {
-      Value *k = binding.first;
-      const std::set<Value *> &s = binding.second;
+  // arena必须在summaries之前定义，保证最后析构
+  StateArena arena;
+  std::map<Key, std::vector<std::unique_ptr<Summary>>> summaries;
 
-      auto result = destBindings.find(k);
-      if (result == destBindings.end()) {
-        destBindings.insert(std::make_pair(k, s));
-      } else {
-        result->second.insert(s.begin(), s.end());
+  SummaryFile *file = nullptr;
+  ValueCodec *codec = nullptr;
+
+  static Key makeKey(Function *func, const PointToSets &entry) {
+    const Fingerprint &fp = entry.getFingerprint();
+    return std::make_tuple(func, fp.lo, fp.hi);
+  }
+
+  const Summary *insertSummary(Function *func, const PointToSets &entry,
+                               const PointToSets &exit,
+                               const CallTargetMap &callTargets,
+                               const ModRefLog &modRefLog,
+                               const std::set<CallInst *> &degradedCalls,
+                               const std::set<CallInst *> &openCalls) {
+    // 摘要要比被调函数的内存池活得更久，拷贝到缓存自己的内存池里
+    ArenaScope arenaScope(arena);
+    std::unique_ptr<Summary> summary(new Summary{
+        entry, exit, callTargets, modRefLog, degradedCalls, openCalls});
+    auto &bucket = summaries[makeKey(func, entry)];
+    bucket.push_back(std::move(summary));
+    return bucket.back().get();
+  }
+
+  /// 缓存文件中的键，入口状态无法编码时返回 false
+  bool getStoreKey(Function *func, const PointToSets &entry,
+                   MD5::MD5Result &key) {
+    if (!file) {
+      return false;
+    }
+    std::string entryPayload;
+    SummaryWriter writer(entryPayload);
+    if (!encodeState(entry, writer)) {
+      return false;
+    }
+    MD5 hash;
+    hash.update(codec->getFunctionKey(func).Bytes);
+    // 通过函数指针传进来的函数不在 func 引用的函数中，它们的内容也要计入
+    std::set<Function *> inputs;
+    collectFunctions(entry, inputs);
+    for (Function *input : sortByName(inputs)) {
+      hash.update(input->getName());
+      hash.update(codec->getFunctionKey(input).Bytes);
+    }
+    // 会改变被调函数分析结果的选项都要放进键里
+    hash.update(PruneCalleeState ? "prune" : "noprune");
+    hash.update(FilterCalleeTypes ? "filter" : "nofilter");
+    hash.update(entryPayload);
+    hash.final(key);
+    return true;
+  }
+
+  /// 状态中作为键或者元素出现的函数
+  static void collectFunctions(const PointToSets &state,
+                               std::set<Function *> &funcs) {
+    auto add = [&funcs](Value *v) {
+      if (Function *func = dyn_cast<Function>(v)) {
+        funcs.insert(func);
+      }
+    };
+    for (const ValueSetMap *map : {&state.getPointToSets(),
+                                   &state.getBindings()}) {
+      for (const auto &entry : *map) {
+        add(entry.first);
+        std::for_each(entry.second.begin(), entry.second.end(), add);
+      }
+    }
+    for (const auto &alias : state.getAliases()) {
+      add(alias.first);
+      add(alias.second);
+    }
+  }
+
+  /// 按名字排序，键与函数在内存中的地址无关
+  static std::vector<Function *> sortByName(const std::set<Function *> &funcs) {
+    std::vector<Function *> sorted(funcs.begin(), funcs.end());
+    std::sort(sorted.begin(), sorted.end(), [](Function *a, Function *b) {
+      return a->getName() < b->getName();
+    });
+    return sorted;
+  }
+
+  /// 出口状态和调用结果中出现的函数连同它们的键一起保存，读出时逐个检查
+  bool encodeDependencies(const PointToSets &exit,
+                          const CallTargetMap &callTargets,
+                          SummaryWriter &writer) {
+    std::set<Function *> funcs;
+    collectFunctions(exit, funcs);
+    for (const auto &entry : callTargets) {
+      funcs.insert(entry.second.begin(), entry.second.end());
+    }
+    writer.writeInt(funcs.size());
+    for (Function *func : sortByName(funcs)) {
+      std::string code = codec->encode(func);
+      if (code.empty()) {
+        return false;
+      }
+      MD5::MD5Result key = codec->getFunctionKey(func);
+      writer.writeString(code);
+      writer.writeString(toStringRef(key));
+    }
+    return true;
+  }
+
+  /// 结果中的函数都还存在并且键没有变化
+  bool checkDependencies(SummaryReader &reader) {
+    for (uint32_t i = 0, n = reader.readInt(); i < n && !reader.failed(); i++) {
+      Value *value = codec->decode(reader.readString());
+      StringRef stored = reader.readString();
+      Function *func = dyn_cast_or_null<Function>(value);
+      if (!func || stored != toStringRef(codec->getFunctionKey(func))) {
+        return false;
+      }
+    }
+    return !reader.failed();
+  }
+
+  static StringRef toStringRef(const MD5::MD5Result &key) {
+    return StringRef(reinterpret_cast<const char *>(key.Bytes.data()),
+                     key.Bytes.size());
+  }
+
+  /// 编码后的键值对按编码排序，保证相同的状态总是得到相同的编码
+  bool encodeSets(const ValueSetMap &map, SummaryWriter &writer) {
+    std::vector<std::pair<std::string, std::vector<std::string>>> entries;
+    for (const auto &entry : map) {
+      std::vector<std::string> values;
+      for (Value *v : entry.second) {
+        values.push_back(codec->encode(v));
+        if (values.back().empty()) {
+          return false;
+        }
+      }
+      std::sort(values.begin(), values.end());
+      entries.emplace_back(codec->encode(entry.first), std::move(values));
+      if (entries.back().first.empty()) {
+        return false;
+      }
+    }
+    std::sort(entries.begin(), entries.end());
+    writer.writeInt(entries.size());
+    for (const auto &entry : entries) {
+      writer.writeString(entry.first);
+      writer.writeInt(entry.second.size());
+      for (const std::string &v : entry.second) {
+        writer.writeString(v);
+      }
+    }
+    return true;
+  }
+
+  bool encodeState(const PointToSets &state, SummaryWriter &writer) {
+    if (!encodeSets(state.getPointToSets(), writer) ||
+        !encodeSets(state.getBindings(), writer)) {
+      return false;
+    }
+    std::vector<std::pair<std::string, std::string>> aliases;
+    for (const auto &alias : state.getAliases()) {
+      aliases.emplace_back(codec->encode(alias.first),
+                           codec->encode(alias.second));
+      if (aliases.back().first.empty() || aliases.back().second.empty()) {
+        return false;
+      }
+    }
+    std::sort(aliases.begin(), aliases.end());
+    writer.writeInt(aliases.size());
+    for (const auto &alias : aliases) {
+      writer.writeString(alias.first);
+      writer.writeString(alias.second);
+    }
+    return true;
+  }
+
+  template <class SetFn>
+  bool decodeSets(SummaryReader &reader, SetFn setFn) {
+    for (uint32_t i = 0, n = reader.readInt(); i < n && !reader.failed(); i++) {
+      Value *key = codec->decode(reader.readString());
+      ValueSet values;
+      for (uint32_t j = 0, m = reader.readInt(); j < m && !reader.failed();
+           j++) {
+        Value *v = codec->decode(reader.readString());
+        if (!v) {
+          return false;
+        }
+        values.insert(v);
+      }
+      if (!key) {
+        return false;
+      }
+      setFn(key, std::move(values));
+    }
+    return !reader.failed();
+  }
+
+  bool decodeState(SummaryReader &reader, PointToSets &state) {
+    if (!decodeSets(reader,
+                    [&state](Value *key, ValueSet values) {
+                      state.setPTS(key, std::move(values));
+                    }) ||
+        !decodeSets(reader, [&state](Value *key, ValueSet values) {
+          state.setBinding(key, std::move(values));
+        })) {
+      return false;
+    }
+    for (uint32_t i = 0, n = reader.readInt(); i < n && !reader.failed(); i++) {
+      Value *value = codec->decode(reader.readString());
+      Value *target = codec->decode(reader.readString());
+      if (!value || !target) {
+        return false;
+      }
+      state.setAlias(value, target);
+    }
+    return !reader.failed();
+  }
+
+  bool encodeCallTargets(const CallTargetMap &callTargets,
+                         SummaryWriter &writer) {
+    std::vector<std::pair<std::string, std::vector<std::string>>> entries;
+    for (const auto &entry : callTargets) {
+      std::vector<std::string> callees;
+      for (Function *callee : entry.second) {
+        callees.push_back(codec->encode(callee));
+        if (callees.back().empty()) {
+          return false;
+        }
+      }
+      std::sort(callees.begin(), callees.end());
+      entries.emplace_back(codec->encode(entry.first), std::move(callees));
+      if (entries.back().first.empty()) {
+        return false;
+      }
+    }
+    std::sort(entries.begin(), entries.end());
+    writer.writeInt(entries.size());
+    for (const auto &entry : entries) {
+      writer.writeString(entry.first);
+      writer.writeInt(entry.second.size());
+      for (const std::string &callee : entry.second) {
+        writer.writeString(callee);
+      }
+    }
+    return true;
+  }
+
+  bool decodeCallTargets(SummaryReader &reader, CallTargetMap &callTargets) {
+    for (uint32_t i = 0, n = reader.readInt(); i < n && !reader.failed(); i++) {
+      CallInst *call = dyn_cast_or_null<CallInst>(
+          codec->decode(reader.readString()));
+      if (!call) {
+        return false;
+      }
+      std::set<Function *> &callees = callTargets[call];
+      for (uint32_t j = 0, m = reader.readInt(); j < m && !reader.failed();
+           j++) {
+        Function *callee =
+            dyn_cast_or_null<Function>(codec->decode(reader.readString()));
+        if (!callee) {
+          return false;
+        }
+        callees.insert(callee);
+      }
+    }
+    return !reader.failed();
+  }
+
+  bool encodeCalls(const std::set<CallInst *> &calls, SummaryWriter &writer) {
+    std::vector<std::string> encoded;
+    for (CallInst *call : calls) {
+      encoded.push_back(codec->encode(call));
+      if (encoded.back().empty()) {
+        return false;
       }
     }
+    std::sort(encoded.begin(), encoded.end());
+    writer.writeInt(encoded.size());
+    for (const std::string &call : encoded) {
+      writer.writeString(call);
+    }
+    return true;
+  }
+
+  bool decodeCalls(SummaryReader &reader, std::set<CallInst *> &calls) {
+    for (uint32_t i = 0, n = reader.readInt(); i < n && !reader.failed(); i++) {
+      CallInst *call = dyn_cast_or_null<CallInst>(
+          codec->decode(reader.readString()));
+      if (!call) {
+        return false;
+      }
+      calls.insert(call);
+    }
+    return !reader.failed();
+  }
+
+  bool encodeModRefLog(const ModRefLog &log, SummaryWriter &writer) {
+    std::vector<std::string> accesses, callSites;
+    for (const auto &access : log.accesses) {
+      std::string func = codec->encode(std::get<0>(access));
+      std::string object = codec->encode(std::get<1>(access));
+      if (func.empty() || object.empty()) {
+        return false;
+      }
+      accesses.push_back(func + '\0' + object + '\0' +
+                         char('0' + std::get<2>(access)));
+    }
+    for (const auto &callSite : log.callSites) {
+      std::string call = codec->encode(callSite.first);
+      std::string callee = codec->encode(callSite.second);
+      if (call.empty() || callee.empty()) {
+        return false;
+      }
+      callSites.push_back(call + '\0' + callee);
+    }
+    for (std::vector<std::string> *records : {&accesses, &callSites}) {
+      std::sort(records->begin(), records->end());
+      writer.writeInt(records->size());
+      for (const std::string &record : *records) {
+        writer.writeString(record);
+      }
+    }
+    return true;
+  }
+
+  bool decodeModRefLog(SummaryReader &reader, ModRefLog &log) {
+    for (uint32_t i = 0, n = reader.readInt(); i < n && !reader.failed(); i++) {
+      SmallVector<StringRef, 3> fields;
+      reader.readString().split(fields, '\0');
+      if (fields.size() != 3 || fields[2].size() != 1) {
+        return false;
+      }
+      Function *func = dyn_cast_or_null<Function>(codec->decode(fields[0]));
+      Value *object = codec->decode(fields[1]);
+      if (!func || !object) {
+        return false;
+      }
+      log.accesses.insert(std::make_tuple(
+          func, object, static_cast<unsigned char>(fields[2][0] - '0')));
+    }
+    for (uint32_t i = 0, n = reader.readInt(); i < n && !reader.failed(); i++) {
+      SmallVector<StringRef, 2> fields;
+      reader.readString().split(fields, '\0');
+      if (fields.size() != 2) {
+        return false;
+      }
+      CallInst *call = dyn_cast_or_null<CallInst>(codec->decode(fields[0]));
+      Function *callee = dyn_cast_or_null<Function>(codec->decode(fields[1]));
+      if (!call || !callee) {
+        return false;
+      }
+      log.callSites.insert(std::make_pair(call, callee));
+    }
+    return !reader.failed();
+  }
+};
+
+///
+/// 一次模块分析中所有 visitor 共享的信息，递归分析被调函数时原样传下去
+///
+struct AnalysisContext {
+  const ArgModRef *argModRef = nullptr;
+  ModRefSummary *modRef = nullptr;
+  CallSummaryCache *summaries = nullptr;
+  AnalysisStats *stats = nullptr; // 没有打开统计时为空
+  AnalysisBudget *budget = nullptr;
+  const AddressTakenIndex *addressTaken = nullptr;
+  // 读入函数体的回调，分析第一次到达一个没有函数体的函数时调用
+  std::function<void(Function *)> materialize;
+};
+
+class PointToVisitor : public DataflowVisitor<struct PointToSets> {
+public:
+  // 保存函数调用结果，即调用指令和它可能调用的函数
+  CallTargetMap callSiteTargets;
+  // 这个 visitor（以及它递归分析的被调函数）对读写摘要所做的修改
+  ModRefLog modRefLog;
+  // 结果来自超出预算后的近似分析的调用点
+  std::set<CallInst *> degradedCalls;
+  // 被调函数可能不止 callSiteTargets 中那些的调用点：函数指针的来源未知
+  // （比如分析入口的形参），或者有目标因为类型对不上被过滤掉了
+  std::set<CallInst *> openCalls;
+
+private:
+  AnalysisContext *context;
+  unsigned depth; // 被调函数的递归深度，入口函数为 0
+  // 流不敏感的近似分析：所有到达的函数共用一个状态，只做弱更新，调用不递归
+  bool flowInsensitive;
+  // 近似分析的第二轮，这时才给解析不出目标的函数指针补上所有可能的目标
+  bool resolveUnknown = false;
+  std::vector<Function *> reached; // 近似分析到达的函数
+  uint64_t steps = 0;              // 这个 visitor 自己处理过的指令数
+  BudgetKind abortReason = BudgetKind::None;
+
+public:
+  explicit PointToVisitor(AnalysisContext *context = nullptr,
+                          unsigned depth = 0, bool flowInsensitive = false)
+      : context(context), depth(depth), flowInsensitive(flowInsensitive) {}
+
+  using DataflowVisitor<PointToSets>::compDFVal;
+
+  void compDFVal(BasicBlock *block, PointToSets *dfval,
+                 bool isforward) override {
+    TraceWriter *trace = TraceWriter::get();
+    uint64_t start = trace ? TraceWriter::now() : 0;
+    DataflowVisitor<PointToSets>::compDFVal(block, dfval, isforward);
+    if (trace) {
+      trace->complete(block->hasName() ? block->getName() : "block", "block",
+                      start, [block](json::OStream &json) {
+                        json.attribute("function",
+                                       block->getParent()->getName());
+                      });
+    }
+    if (AnalysisStats *stats = getStats()) {
+      stats->blockVisits++;
+      stats->functions[block->getParent()].blockVisits++;
+      stats->recordStateSize(dfval->size());
+    }
+    if (StateBudget && isBudgeted() && abortReason == BudgetKind::None &&
+        dfval->size() > StateBudget) {
+      abortReason = BudgetKind::StateSize;
+    }
+  }
+
+  /// 被调函数的分析超出预算时放弃，由调用者改用近似，入口函数总是算完
+  bool shouldStop() override {
+    if (abortReason == BudgetKind::None && isBudgeted() && context &&
+        context->budget) {
+      abortReason = context->budget->check();
+    }
+    return abortReason != BudgetKind::None;
+  }
+
+  void merge(PointToSets *dest, const PointToSets &src) override {
+    if (AnalysisStats *stats = getStats()) {
+      stats->merges++;
+    }
+    // 一般情况下绑定信息是不需要在基本块之间传递的，但是为了能够解决引用型参数和函数返回问题，
+    // 在这里也进行合并，不影响结果，但是可能会让调试信息更杂乱。
+    dest->mergeFrom(src);
   }
 
   ///
@@ -202,8 +987,19 @@ public:
     if (isa<DbgInfoIntrinsic>(inst)) {
       return;
     }
+    if (AnalysisStats *stats = getStats()) {
+      stats->transfers++;
+    }
+    steps++;
+    if (context && context->budget) {
+      context->budget->addStep();
+    }
+    if (FunctionStepBudget && isBudgeted() && steps > FunctionStepBudget &&
+        abortReason == BudgetKind::None) {
+      abortReason = BudgetKind::FunctionSteps;
+    }
 
-    LOG_DEBUG("Current instruction: " << *inst);
+    LOG_TRACE(LogTransfer, "Current instruction: " << *inst);
 
     // 根据指令的类型去进行相应的处理操作
     if (AllocaInst *allocaInst = dyn_cast<AllocaInst>(inst)) {
@@ -222,73 +1018,155 @@ public:
     } else if (MemCpyInst *memCpyInst = dyn_cast<MemCpyInst>(inst)) {
       handleMemCpyInst(memCpyInst, dfval);
     } else if (MemSetInst *memSetInst = dyn_cast<MemSetInst>(inst)) {
-      // 捕获但不需要处理，防止它被后面CallInst的处理逻辑捕获
+      // 捕获但不需要处理指向关系，防止它被后面CallInst的处理逻辑捕获
+      recordAccess(memSetInst, memSetInst->getDest(), dfval,
+                   ModRefSummary::Mod);
     } else if (ReturnInst *returnInst = dyn_cast<ReturnInst>(inst)) {
       handleReturnInst(returnInst, dfval);
     } else if (CallInst *callInst = dyn_cast<CallInst>(inst)) {
       handleCallInst(callInst, dfval);
     } else {
-      LOG_DEBUG("Unhandled instruction: " << *inst);
+      LOG_DEBUG(LogTransfer, "Unhandled instruction: " << *inst);
     }
   }
 
-  void printResults(raw_ostream &out) const {
-    for (const auto &result : functionCallResult) {
-      out << result.first << " : ";
-      const auto &funcNames = result.second;
-      for (auto iter = funcNames.begin(); iter != funcNames.end(); iter++) {
-        if (iter != funcNames.begin()) {
-          out << ", ";
-        }
-        out << *iter;
-      }
-      out << "\n";
+  /// 把另一个 visitor 得到的调用结果并入当前结果
+  void mergeCallTargets(const CallTargetMap &targets) {
+    for (const auto &entry : targets) {
+      callSiteTargets[entry.first].insert(entry.second.begin(),
+                                          entry.second.end());
     }
   }
 
 private:
+  AnalysisStats *getStats() const { return context ? context->stats : nullptr; }
+
+  /// 是否受单个函数的预算限制：递归精确分析的被调函数
+  bool isBudgeted() const { return depth > 0 && !flowInsensitive; }
+
+  /// 函数指针绑定中的函数是否可能是这个调用点的目标，类型对不上的不分析
+  bool isPossibleCallee(CallInst *callInst, Function *func) {
+    if (!FilterCalleeTypes) {
+      return true;
+    }
+    if (AddressTakenIndex::isPossibleTarget(callInst, func)) {
+      return true;
+    }
+    openCalls.insert(callInst);
+    LOG_DEBUG(LogCall, "Skipping callee " << func->getName()
+                                          << " that cannot be called at "
+                                          << getLocationString(callInst));
+    if (AnalysisStats *stats = getStats()) {
+      stats->filteredCallees++;
+    }
+    return false;
+  }
+
+  /// 精确分析下一层被调函数之前检查预算
+  BudgetKind checkCallBudget() const {
+    if (depth + 1 > DepthBudget) {
+      return BudgetKind::Depth;
+    }
+    if (context && context->budget) {
+      return context->budget->check();
+    }
+    return BudgetKind::None;
+  }
+
+  /// 强更新；近似分析中的状态是所有程序点的并，只能弱更新
+  void updatePTS(PointToSets *dfval, Value *pointer, ValueSet set) {
+    if (flowInsensitive) {
+      dfval->addPTS(pointer, set);
+    } else {
+      dfval->setPTS(pointer, std::move(set));
+    }
+  }
+
+  void updateBinding(PointToSets *dfval, Value *value, ValueSet set) {
+    if (flowInsensitive) {
+      dfval->addBinding(value, set);
+    } else {
+      dfval->setBinding(value, std::move(set));
+    }
+  }
+
+  /// 调用点的位置 file:line:column，没有调试信息时为空
+  static std::string getLocationString(Instruction *inst) {
+    const DILocation *loc = inst->getDebugLoc().get();
+    if (!loc) {
+      return "";
+    }
+    return (loc->getFilename() + ":" + Twine(loc->getLine()) + ":" +
+            Twine(loc->getColumn()))
+        .str();
+  }
+
+  /// 函数体可能还没有读入（懒加载），或者在其他模块中（跨模块导入），先读进来。
+  /// 读入失败时函数体仍然是空的
+  void materialize(Function *func) const {
+    if (func->empty() && context && context->materialize) {
+      LOG_DEBUG(LogLoad, "Materializing function: " << func->getName());
+      context->materialize(func);
+    }
+  }
+
+  /// 把 inst 通过 pointer 对内存的读写记入读写摘要
+  void recordAccess(Instruction *inst, Value *pointer, PointToSets *dfval,
+                    ModRefSummary::ModRefKind kind) {
+    if (!context || !context->modRef) {
+      return;
+    }
+    Function *func = inst->getFunction();
+    ModRefSummary *modRef = context->modRef;
+    ModRefLog &log = modRefLog;
+    dfval->forEachTarget(pointer, [modRef, &log, func, kind](Value *object) {
+      modRef->addAccess(func, object, kind);
+      log.accesses.insert(std::make_tuple(func, object, kind));
+    });
+  }
+
   /// *x = y
   /// store <ty> <value>, <ty>* <pointer>
   void handleStoreInst(StoreInst *storeInst, PointToSets *dfval) {
     Value *value = storeInst->getValueOperand();
     Value *pointer = storeInst->getPointerOperand();
 
+    // 存常数也是写内存，要在跳过之前记下来
+    recordAccess(storeInst, pointer, dfval, ModRefSummary::Mod);
+
     // https://llvm.org/doxygen/classllvm_1_1Constant.html
     if (isa<ConstantData>(value)) {
-      LOG_DEBUG("Skipped constant data " << *value << " in StoreInst.");
+      LOG_TRACE(LogTransfer,
+                "Skipped constant data " << *value << " in StoreInst.");
       return;
     }
 
-    // pointer可能指向多个目标，要依次对每一个进行指向
-    std::set<Value *> queue = {pointer};
-    std::set<Value *> targets;
-    while (!queue.empty()) {
-      Value *v = *queue.begin();
-      queue.erase(v);
-      if (dfval->hasBinding(v)) {
-        std::set<Value *> s = dfval->getBinding(v);
-        queue.insert(s.begin(), s.end());
-      } else {
-        targets.insert(v);
-      }
+    // value有绑定时直接使用绑定集合的只读视图，不再拷贝
+    Value *valueRoot = dfval->resolveAlias(value);
+    ValueSet single;
+    const ValueSet *values = &single;
+    if (dfval->hasBinding(valueRoot)) {
+      values = &dfval->getBinding(valueRoot);
+    } else {
+      single.insert(valueRoot);
     }
 
-    std::set<Value *> values;
-    if (dfval->hasBinding(value)) {
-      values = dfval->getBinding(value);
-    } else {
-      values.insert(value);
+    // pointer可能指向多个目标，要依次对每一个进行指向
+    // 绑定的目标本身不会再有绑定，经过别名找到根之后最多只需要再查一次绑定
+    Value *pointerRoot = dfval->resolveAlias(pointer);
+    if (!dfval->hasBinding(pointerRoot)) {
+      updatePTS(dfval, pointerRoot, *values);
+      return;
     }
 
     // 考虑PPT中store语句的规则2，当存在多个可能的目标时，并不确定实际运行时指向哪一个，
     // 因此不但要依次处理每个目标的指向，还不能将目标原先的指向清空。
+    const ValueSet &targets = dfval->getBinding(pointerRoot);
     if (targets.size() == 1) {
-      dfval->setPTS(*targets.begin(), values);
+      updatePTS(dfval, *targets.begin(), *values);
     } else {
       for (Value *target : targets) {
-        std::set<Value *> oldPTS = dfval->getPTS(target);
-        oldPTS.insert(values.begin(), values.end());
-        dfval->setPTS(target, oldPTS);
+        dfval->addPTS(target, *values);
       }
     }
   }
@@ -299,14 +1177,17 @@ private:
     Value *pointer = loadInst->getPointerOperand();
     Value *result = dyn_cast<Value>(loadInst);
 
+    recordAccess(loadInst, pointer, dfval, ModRefSummary::Ref);
+
     // 只处理二级指针及以上，因为一级指针总是指向常数
     // https://stackoverflow.com/a/12954400/15851567
     if (!pointer->getType()->getContainedType(0)->isPointerTy()) {
       return;
     }
 
-    std::set<Value *> s = dfval->getPTS(pointer);
-    dfval->setBinding(result, s);
+    ValueSet s;
+    dfval->unionPTSInto(pointer, s);
+    updateBinding(dfval, result, std::move(s));
   }
 
   /// <result> = getelementptr inbounds <ty>* <ptrval>{, <ty> <idx>}*
@@ -315,11 +1196,8 @@ private:
     Value *ptrval = getElementPtrInst->getPointerOperand();
     Value *result = dyn_cast<Value>(getElementPtrInst);
 
-    if (dfval->hasBinding(ptrval)) {
-      dfval->setBinding(result, dfval->getBinding(ptrval));
-    } else {
-      dfval->setBinding(result, {ptrval});
-    }
+    // 结果与基址等同，只记录一条别名边，不再拷贝基址的绑定
+    dfval->setAlias(result, ptrval);
   }
 
   void handleMemCpyInst(MemCpyInst *memCpyInst, PointToSets *dfval) {
@@ -327,16 +1205,25 @@ private:
     Value *source = memCpyInst->getSource();
     Value *dest = memCpyInst->getDest();
 
-    // LOG_DEBUG("Source of MemCpyInst: " << *source);
-    // LOG_DEBUG("Dest of MemCpyInst: " << *dest);
+    // LOG_TRACE(LogTransfer, "Source of MemCpyInst: " << *source);
+    // LOG_TRACE(LogTransfer, "Dest of MemCpyInst: " << *dest);
 
-    if (dfval->hasBinding(dest)) {
-      assert(dfval->getBinding(dest).size() == 1);
-      dest = *(dfval->getBinding(dest).begin());
-    }
+    recordAccess(memCpyInst, source, dfval, ModRefSummary::Ref);
+    recordAccess(memCpyInst, dest, dfval, ModRefSummary::Mod);
 
-    std::set<Value *> s = dfval->getPTS(source);
-    dfval->setPTS(dest, s);
+    ValueSet s;
+    dfval->unionPTSInto(source, s);
+    dest = dfval->resolveAlias(dest);
+    if (!dfval->hasBinding(dest)) {
+      updatePTS(dfval, dest, std::move(s));
+      return;
+    }
+    // 近似分析中的绑定是所有程序点的并，可能有多个目标
+    const ValueSet &targets = dfval->getBinding(dest);
+    assert(flowInsensitive || targets.size() == 1);
+    for (Value *target : targets) {
+      updatePTS(dfval, target, s);
+    }
   }
 
   void handleReturnInst(ReturnInst *returnInst, PointToSets *dfval) {
@@ -345,14 +1232,19 @@ private:
 
     if (dfval->hasBinding(func)) {
       // 把返回值直接绑定到所在函数上
-      if (dfval->hasBinding(value)) {
-        dfval->setBinding(func, dfval->getBinding(value));
-      } else {
-        dfval->setBinding(func, {value});
-      }
+      ValueSet values;
+      dfval->forEachTarget(value, [&values](Value *v) { values.insert(v); });
+      updateBinding(dfval, func, std::move(values));
     }
   }
 
+  /// 被调函数通过第 argNo 个形参可能产生的读写，关闭剪枝时总是既读又写
+  unsigned char getArgEffect(Function *func, unsigned argNo) const {
+    if (!PruneCalleeState || !context || !context->argModRef) {
+      return ArgModRef::ModRef;
+    }
+    return context->argModRef->getEffect(func, argNo);
+  }
 
   ///
   /// 将近200行的函数，比较复杂。
@@ -364,90 +1256,123 @@ private:
   /// 
   void handleCallInst(CallInst *callInst, PointToSets *dfval) {
     Value *callResult = dyn_cast<Value>(callInst);
-    Value *fnptrval = callInst->getCalledOperand();
-    unsigned lineno = callInst->getDebugLoc().getLine();
+    // 类型转换后的函数（C 程序中函数指针的强制转换）按原来的函数处理，
+    // 类型是否兼容由 isPossibleCallee 检查
+    Value *fnptrval = callInst->getCalledOperand()->stripPointerCasts();
 
     // 用于后面保存调用结果
-    std::set<std::string> &funcNameSet = functionCallResult[lineno];
+    std::set<Function *> &callees = callSiteTargets[callInst];
 
     // 对malloc函数调用做特殊处理
     if (isa<Function>(fnptrval) && fnptrval->getName() == "malloc") {
-      funcNameSet.insert(fnptrval->getName());
+      callees.insert(cast<Function>(fnptrval));
       return;
     }
 
-    PointToSets initval;
-    PointToVisitor visitor; // visitor在不同的被调函数中共享
-
-    LOG_DEBUG("Current dfval in CallInst: \n" << *dfval);
+    LOG_TRACE(LogCall, "Current dfval in CallInst: \n" << *dfval);
 
     // 可能是直接调用一个函数，比如@clever，也可能是一个指向多个函数的绑定，比如
     // %1 = @plus, @minus
-    std::set<Value *> fnvals;
+    // 这里要拷贝一份，后面写回时可能会修改dfval中的绑定
+    ValueSet fnvals;
     if (isa<Function>(fnptrval)) {
       fnvals.insert(fnptrval);
     } else {
-      fnvals = dfval->getBinding(fnptrval);
+      fnvals = dfval->getBinding(dfval->resolveAlias(fnptrval));
+    }
+    if (fnvals.empty()) {
+      openCalls.insert(callInst);
+    }
+
+    if (flowInsensitive) {
+      bindCallFlowInsensitive(callInst, resolveCalleesFlowInsensitive(
+                                            callInst, fnvals),
+                              dfval);
+      return;
     }
 
     // 对每一个被调用函数都进行参数绑定和递归处理
     for (Value *fnval : fnvals) {
-      Function *func = dyn_cast<Function>(fnval);
-      std::string funcName = func->getName();
+      Function *func = dyn_cast<Function>(fnval->stripPointerCasts());
+      if (!func) {
+        // 从分析入口的形参中读出来的函数指针，不知道指向哪里
+        openCalls.insert(callInst);
+        continue;
+      }
+      if (!isPossibleCallee(callInst, func)) {
+        continue;
+      }
+      callees.insert(func);
+      materialize(func);
+      if (func->empty()) {
+        // 没有函数体可以分析，只记录调用结果
+        continue;
+      }
       BasicBlock *targetEntry = &(func->getEntryBlock());
       BasicBlock *targetExit = &(func->back());
+
+      // 被调函数分析过程中产生的状态都分配在这个内存池里，分析结束后整体释放。
+      // 对dfval的写回使用的是dfval自己的内存池，不受影响。
+      // arena必须在下面所有容器之前定义，保证最后析构
+      StateArena arena;
+      ArenaScope arenaScope(arena);
+      PointToVisitor visitor(context, depth + 1);
+      PointToSets initval;
       PointToSets calleeArgBindings;
       std::set<std::pair<Value *, Value *>> argPairs;
       DataflowResult<PointToSets>::Type result;
 
-      funcNameSet.insert(funcName);
-
       // 进行参数的绑定
-      for (unsigned i = 0, num = callInst->getNumArgOperands(); i < num; i++) {
+      // 被调函数不会访问的实参不需要传入可达的对象，不会写的实参也不需要写回
+      ValueSet entryRoots;
+      ValueSet modRoots;
+      // 关闭类型过滤时实参可能比形参多，多出来的实参没有对应的形参
+      unsigned numArgs =
+          std::min<unsigned>(callInst->arg_size(), func->arg_size());
+      for (unsigned i = 0; i < numArgs; i++) {
         Value *callerArg = callInst->getArgOperand(i);
 
         // 只处理指针传递就可以了
         if (callerArg->getType()->isPointerTy()) {
           Value *calleeArg = func->getArg(i);
-
-          argPairs.insert(std::make_pair(callerArg, calleeArg));
+          // 实参是别名（比如结构体成员的地址）时直接使用它等同的值
+          callerArg = dfval->resolveAlias(callerArg);
+          unsigned char effect = getArgEffect(func, i);
 
           if (dfval->hasBinding(callerArg)) {
-            std::set<Value *> bindingTarget = dfval->getBinding(callerArg);
-            calleeArgBindings.setBinding(calleeArg, bindingTarget);
-
-            /// TODO: 可以和下面进行合并
-            std::set<Value *> queue = bindingTarget;
-            while (!queue.empty()) {
-              Value *v = *queue.begin();
-              queue.erase(queue.begin());
-              // LOG_DEBUG("Finding dependency for " << *v);
-              if (dfval->hasPTS(v)) {
-                std::set<Value *> s = dfval->getPTS(v);
-                // LOG_DEBUG("Dependencies found: " << s);
-                calleeArgBindings.setPTS(v, s);
-                //
-                argPairs.insert(std::make_pair(v, v));
-                queue.insert(s.begin(), s.end());
-              }
-            }
+            calleeArgBindings.setBinding(calleeArg,
+                                         dfval->getBinding(callerArg));
           } else {
             calleeArgBindings.setBinding(calleeArg, {callerArg});
+          }
 
-            // callerArg可能会依赖其他的值，找出这些指向关系，一并进行绑定
-            std::set<Value *> queue = {callerArg};
-            while (!queue.empty()) {
-              Value *v = *queue.begin();
-              queue.erase(queue.begin());
-              // LOG_DEBUG("Finding dependency for " << *v);
-              if (dfval->hasPTS(v)) {
-                std::set<Value *> s = dfval->getPTS(v);
-                // LOG_DEBUG("Dependencies found: " << s);
-                calleeArgBindings.setPTS(v, s);
-                //
-                argPairs.insert(std::make_pair(v, v));
-                queue.insert(s.begin(), s.end());
-              }
+          if (effect != ArgModRef::NoEffect) {
+            dfval->forEachTarget(
+                callerArg, [&entryRoots](Value *v) { entryRoots.insert(v); });
+          }
+          if (effect & ArgModRef::Mod) {
+            argPairs.insert(std::make_pair(callerArg, calleeArg));
+            dfval->forEachTarget(
+                callerArg, [&modRoots](Value *v) { modRoots.insert(v); });
+          }
+        }
+      }
+
+      // callerArg可能会依赖其他的值，找出这些指向关系，一并进行绑定。
+      // 前一个被调函数的写回会修改dfval，可达性索引要在写回之后重新取，
+      // 索引是增量更新的，没有修改时直接复用
+      if (!entryRoots.empty()) {
+        std::shared_ptr<const ReachabilityIndex> reach =
+            dfval->getReachability();
+        BitVector entryReached, modReached;
+        reach->addReachable(entryRoots, entryReached);
+        reach->addReachable(modRoots, modReached);
+        for (unsigned id : entryReached.set_bits()) {
+          Value *v = reach->getNode(id);
+          if (dfval->hasPTS(v)) {
+            calleeArgBindings.setPTS(v, dfval->getPTS(v));
+            if (modReached.size() > id && modReached.test(id)) {
+              argPairs.insert(std::make_pair(v, v));
             }
           }
         }
@@ -455,117 +1380,525 @@ private:
 
       // 返回值绑定
       if (func->getReturnType()->isPointerTy()) {
-        LOG_DEBUG("Function " << func->getName()
-                              << " has a pointer return type.");
+        LOG_TRACE(LogCall, "Function " << func->getName()
+                                       << " has a pointer return type.");
         calleeArgBindings.setBinding(func, {func});
         argPairs.insert(std::make_pair(callResult, func));
       }
 
-      result[targetEntry].first =
-          calleeArgBindings; // incomings of target entry
-
-      LOG_DEBUG("Now recursively handling function: " << func->getName());
-      compForwardDataflow(func, &visitor, &result, initval);
+      CallSummaryCache *summaries =
+          ReuseCallSummaries && context ? context->summaries : nullptr;
+      bool loaded = false;
+      const CallSummaryCache::Summary *summary =
+          summaries ? summaries->lookup(func, calleeArgBindings, &loaded)
+                    : nullptr;
+      AnalysisStats *stats = getStats();
+      if (stats && summaries) {
+        (summary ? stats->summaryHits : stats->summaryMisses)++;
+      }
+      TraceWriter *trace = TraceWriter::get();
+      if (trace && summaries) {
+        trace->instant(summary ? "summary hit" : "summary miss", "summary",
+                       [&](json::OStream &json) {
+                         json.attribute("function", func->getName());
+                         json.attribute("from_disk", loaded);
+                       });
+      }
+      if (summary) {
+        LOG_DEBUG(LogSummary,
+                  "Reusing summary of function: " << func->getName());
+        // 从缓存文件中读出的摘要没有经过分析，读写摘要要靠重放记录补上
+        if (loaded && context->modRef) {
+          summary->modRefLog.replay(*context->modRef);
+        }
+      } else {
+        BudgetKind degrade = checkCallBudget();
+        if (degrade == BudgetKind::None) {
+          result[targetEntry].first =
+              calleeArgBindings; // incomings of target entry
+
+          LOG_DEBUG(LogCall,
+                    "Now recursively handling function: " << func->getName());
+          if (stats) {
+            stats->functions[func].analyses++;
+            stats->maxCallDepth = std::max(stats->maxCallDepth, depth + 1);
+          }
+          uint64_t start = trace ? TraceWriter::now() : 0;
+          compForwardDataflow(func, &visitor, &result, initval);
+          if (trace) {
+            trace->complete(
+                func->getName(), "function", start, [&](json::OStream &json) {
+                  json.attribute("depth", depth + 1);
+                  json.attribute("caller", callInst->getFunction()->getName());
+                  json.attribute("call_site", getLocationString(callInst));
+                });
+          }
+          degrade = visitor.abortReason;
+        }
+        // 超出预算时丢掉不完整的结果，改用近似
+        if (degrade != BudgetKind::None) {
+          approximateCall(callInst, func, degrade, dfval);
+          continue;
+        }
+        if (summaries) {
+          summary = summaries->insert(
+              func, calleeArgBindings, result[targetExit].second,
+              visitor.callSiteTargets, visitor.modRefLog,
+              visitor.degradedCalls, visitor.openCalls);
+        }
+      }
+      mergeCallTargets(summary ? summary->callTargets
+                               : visitor.callSiteTargets);
+      modRefLog.merge(summary ? summary->modRefLog : visitor.modRefLog);
+      const std::set<CallInst *> &calleeDegraded =
+          summary ? summary->degradedCalls : visitor.degradedCalls;
+      degradedCalls.insert(calleeDegraded.begin(), calleeDegraded.end());
+      const std::set<CallInst *> &calleeOpen =
+          summary ? summary->openCalls : visitor.openCalls;
+      openCalls.insert(calleeOpen.begin(), calleeOpen.end());
+
+      // 被调函数（以及它调用的函数）的读写这时已经都记录下来了
+      if (context && context->modRef) {
+        context->modRef->addCallSite(callInst, func);
+        modRefLog.callSites.insert(std::make_pair(callInst, func));
+      }
 
-      PointToSets &calleeOutBindings =
-          result[targetExit].second; // outcomings of target exit
+      const PointToSets &calleeOutBindings =
+          summary ? summary->exit
+                  : result[targetExit].second; // outcomings of target exit
 
       /// 调用完成后根据目标函数最终的outcoming更新当前函数内的变量指向
-      /// TODO: 这块看起来很复杂实际上很多内容可以合并精简，我懒得搞了
+      /// 指向集发生变化的对象可能在实参可达的任何位置，这部分的根先收集起来，
+      /// 最后用被调函数出口状态的可达性索引一次性求出闭包
+      ValueSet writeBackRoots;
       for (auto &pair : argPairs) {
         // 参数返回
         if (calleeOutBindings.hasBinding(pair.second)) {
-          const std::set<Value *> &outBinding =
+          const ValueSet &outBinding =
               calleeOutBindings.getBinding(pair.second);
-          const std::set<Value *> &inBinding =
+          const ValueSet &inBinding =
               calleeArgBindings.getBinding(pair.second);
           if (outBinding != inBinding) {
-            std::set<Value *> binding;
-            if (dfval->hasBinding(pair.first)) {
-              const std::set<Value *> &oldBinding =
-                  dfval->getBinding(pair.first);
-              binding = oldBinding;
-            }
-            const std::set<Value *> &newBinding =
-                calleeOutBindings.getBinding(pair.second);
-            binding.insert(newBinding.begin(), newBinding.end());
-            dfval->setBinding(pair.first, binding);
+            // 新的绑定 = 原有的绑定 ∪ 被调函数中的绑定
+            dfval->addBinding(pair.first, outBinding);
           } else {
-            std::set<Value *> queue = outBinding;
+            // 只沿着指向集发生了变化的对象继续往下找
+            ValueSet queue = outBinding;
+            ValueSet visited;
             while (!queue.empty()) {
               Value *v = *queue.begin();
               queue.erase(v);
+              if (!visited.insert(v).second) {
+                continue;
+              }
               if (calleeOutBindings.hasPTS(v) &&
                   (!calleeArgBindings.hasPTS(v) ||
                    calleeOutBindings.getPTS(v) !=
                        calleeArgBindings.getPTS(v))) {
-                std::set<Value *> s = calleeOutBindings.getPTS(v);
-                LOG_DEBUG("s: " << s);
+                const ValueSet &s = calleeOutBindings.getPTS(v);
+                LOG_TRACE(LogCall, "s: " << s);
                 dfval->setPTS(v, s);
                 queue.insert(s.begin(), s.end());
               }
             }
           }
         } else {
-          std::set<Value *> queue = {pair.second};
-          while (!queue.empty()) {
-            Value *v = *queue.begin();
-            queue.erase(v);
-
-            if (calleeOutBindings.hasPTS(v) &&
-                (!calleeArgBindings.hasPTS(v) ||
-                 calleeOutBindings.getPTS(v) != calleeArgBindings.getPTS(v))) {
-              std::set<Value *> s = calleeOutBindings.getPTS(v);
-              dfval->setPTS(v, s);
-              queue.insert(s.begin(), s.end());
-            } else {
-              if (calleeOutBindings.hasPTS(v)) {
-                std::set<Value *> s = calleeOutBindings.getPTS(v);
-                queue.insert(s.begin(), s.end());
-              }
-            }
+          writeBackRoots.insert(pair.second);
+        }
+      }
+
+      if (!writeBackRoots.empty()) {
+        std::shared_ptr<const ReachabilityIndex> reach =
+            calleeOutBindings.getReachability();
+        BitVector reached;
+        reach->addReachable(writeBackRoots, reached);
+        for (unsigned id : reached.set_bits()) {
+          Value *v = reach->getNode(id);
+          if (calleeOutBindings.hasPTS(v) &&
+              (!calleeArgBindings.hasPTS(v) ||
+               calleeOutBindings.getPTS(v) != calleeArgBindings.getPTS(v))) {
+            dfval->setPTS(v, calleeOutBindings.getPTS(v));
           }
         }
       }
     }
+  }
+
+  ///
+  /// 超出预算时对一次调用的近似：从调用者的状态出发，把被调函数和它（传递地）调用的
+  /// 所有函数放在同一个状态里做流不敏感、上下文不敏感的分析，所有更新都是弱更新，
+  /// 迭代到不动点。得到的指向关系只会比精确分析多，调用者的状态也只增加不减少。
+  ///
+  void approximateCall(CallInst *callInst, Function *func, BudgetKind reason,
+                       PointToSets *dfval) {
+    LOG_INFO(LogCall, "Budget " << getBudgetName(reason)
+                                << " exceeded, approximating call to "
+                                << func->getName() << " at "
+                                << getLocationString(callInst));
+    if (context && context->budget) {
+      context->budget->addDegraded(reason);
+    }
+    if (TraceWriter *trace = TraceWriter::get()) {
+      trace->instant("approximated", "budget", [&](json::OStream &json) {
+        json.attribute("function", func->getName());
+        json.attribute("budget", getBudgetName(reason));
+        json.attribute("call_site", getLocationString(callInst));
+      });
+    }
+
+    PointToVisitor solver(context, depth + 1, /*flowInsensitive=*/true);
+    PointToSets state = *dfval;
+    solver.bindCallFlowInsensitive(callInst, {func}, &state);
+    solver.solveFlowInsensitive(&state);
 
-    // 更新输出结果集
-    for (auto functionCalls : visitor.functionCallResult) {
-      auto result = functionCallResult.find(functionCalls.first);
-      if (result == functionCallResult.end()) {
-        functionCallResult.insert(functionCalls);
+    // 被调函数中的绑定都是它自己的临时变量，只有指向集和返回值需要写回
+    for (const auto &entry : state.getPointToSets()) {
+      dfval->addPTS(entry.first, entry.second);
+    }
+    if (func->getReturnType()->isPointerTy()) {
+      dfval->addBinding(callInst, state.getBinding(func));
+    }
+
+    mergeCallTargets(solver.callSiteTargets);
+    modRefLog.merge(solver.modRefLog);
+    degradedCalls.insert(solver.degradedCalls.begin(),
+                         solver.degradedCalls.end());
+    openCalls.insert(solver.openCalls.begin(), solver.openCalls.end());
+    if (context && context->modRef) {
+      context->modRef->addCallSite(callInst, func);
+      modRefLog.callSites.insert(std::make_pair(callInst, func));
+    }
+  }
+
+  ///
+  /// 近似分析中调用点可能的目标。第一轮只用状态中的函数指针；到达不动点以后，
+  /// 仍然有未知目标（比如入口函数的形参中读出的函数指针）的调用点再取所有类型相同、
+  /// 被取过地址的函数，然后继续迭代。索引不完整时（懒加载、跨模块导入）不取候选函数，
+  /// 调用点保持未知目标，记为近似结果
+  ///
+  std::vector<Function *> resolveCalleesFlowInsensitive(CallInst *callInst,
+                                                        const ValueSet &fnvals) {
+    std::vector<Function *> targets;
+    bool unknown = fnvals.empty();
+    for (Value *v : fnvals) {
+      if (Function *func = dyn_cast<Function>(v->stripPointerCasts())) {
+        if (isPossibleCallee(callInst, func)) {
+          targets.push_back(func);
+        }
       } else {
-        result->second.insert(functionCalls.second.begin(),
-                              functionCalls.second.end());
+        unknown = true;
       }
     }
+    if (unknown) {
+      openCalls.insert(callInst);
+    }
+    if (unknown && resolveUnknown && context && context->addressTaken &&
+        context->addressTaken->isComplete()) {
+      std::vector<Function *> candidates =
+          context->addressTaken->getCandidates(callInst);
+      targets.insert(targets.end(), candidates.begin(), candidates.end());
+    }
+    return targets;
+  }
+
+  /// 近似分析中的参数和返回值绑定：形参和返回值的绑定是所有调用点的并
+  void bindCallFlowInsensitive(CallInst *callInst,
+                               const std::vector<Function *> &targets,
+                               PointToSets *dfval) {
+    std::set<Function *> &callees = callSiteTargets[callInst];
+    degradedCalls.insert(callInst);
+    for (Function *func : targets) {
+      callees.insert(func);
+      materialize(func);
+      if (func->empty()) {
+        continue;
+      }
+      if (std::find(reached.begin(), reached.end(), func) == reached.end()) {
+        reached.push_back(func);
+      }
+      unsigned num = std::min<unsigned>(callInst->arg_size(), func->arg_size());
+      for (unsigned i = 0; i < num; i++) {
+        Value *callerArg = callInst->getArgOperand(i);
+        if (callerArg->getType()->isPointerTy()) {
+          ValueSet values;
+          dfval->forEachTarget(callerArg,
+                               [&values](Value *v) { values.insert(v); });
+          dfval->addBinding(func->getArg(i), values);
+        }
+      }
+      if (func->getReturnType()->isPointerTy()) {
+        // 先建立空的绑定，handleReturnInst 才会记录返回值
+        dfval->addBinding(func, ValueSet());
+        dfval->addBinding(callInst, dfval->getBinding(func));
+      }
+    }
+  }
+
+  /// 反复处理到达的所有函数的所有基本块，直到状态不再变化
+  void solveFlowInsensitive(PointToSets *state) {
+    for (bool unknown : {false, true}) {
+      resolveUnknown = unknown;
+      Fingerprint before;
+      do {
+        before = state->getFingerprint();
+        // 处理过程中可能到达新的函数，不能用迭代器
+        for (size_t i = 0; i < reached.size(); i++) {
+          for (BasicBlock &block : *reached[i]) {
+            compDFVal(&block, state, true);
+          }
+        }
+      } while (state->getFingerprint() != before);
+    }
   }
 };
 
 class PointToAnalysis : public ModulePass {
 public:
   static char ID;
-  PointToAnalysis() : ModulePass(ID) {}
+  PointToAnalysis() : ModulePass(ID), out(&errs()) {}
+
+  ///
+  /// @param out 分析结果的输出位置
+  /// @param materialize 负责为没有函数体的函数读入函数体（懒加载或者跨模块导入），
+  ///                    并做好分析前的变换（比如 mem2reg），为空时只分析模块中已有的函数体
+  ///
+  explicit PointToAnalysis(raw_ostream &out,
+                           std::function<void(Function *)> materialize = {})
+      : ModulePass(ID), out(&out), materialize(std::move(materialize)) {}
+
+  /// 最近一次分析得到的读写摘要，只包含分析中实际到达的函数和调用点
+  const ModRefSummary &getModRefSummary() const { return modRefSummary; }
+
+  /// 最近一次分析得到的调用结果，只包含分析中实际到达的调用点
+  const CallTargetMap &getCallTargets() const { return callTargets; }
+
+  /// 最近一次分析中被调函数可能不止 getCallTargets 中那些的调用点
+  const std::set<CallInst *> &getOpenCalls() const { return openCalls; }
+
+  /// 分析结束时把结果快照的内容写到 data，与 -snapshot 无关
+  void setSnapshotOutput(std::string *data) { snapshotData = data; }
 
   bool runOnModule(Module &M) override {
+    // 懒加载模式下按需运行的 mem2reg 也算在分析时间里
+    Optional<PhaseTimer> analysisTimer;
+    analysisTimer.emplace("analysis");
+
+    ArgModRef argModRef(M);
+    AddressTakenIndex addressTaken(M);
+    modRefSummary = ModRefSummary();
+    AnalysisStats stats;
+    AnalysisBudget budget;
+    AnalysisContext context;
+    context.argModRef = &argModRef;
+    context.modRef = &modRefSummary;
+    context.budget = &budget;
+    context.addressTaken = &addressTaken;
+    if (isStatsEnabled()) {
+      context.stats = &stats;
+    }
+    // 不同入口到达同一个函数时，相同的入口状态只分析一次
+    CallSummaryCache summaries;
+    context.summaries = &summaries;
+    if (materialize) {
+      // 没有读入或者还在其他模块中的函数体里的用法看不到
+      addressTaken.setIncomplete();
+      context.materialize = [this, &argModRef, &addressTaken](Function *F) {
+        materialize(F);
+        argModRef.addFunction(F);
+        if (!F->empty()) {
+          addressTaken.addFunctionBody(F);
+        }
+      };
+    }
+
+    // 摘要缓存文件，键没有变化的被调函数直接使用上次运行的结果
+    std::string summaryCacheFile =
+        SummaryCachePath.empty() ? "" : getSummaryCacheFile(M);
+    SummaryFile summaryFile;
+    ValueCodec codec(M, context.materialize);
+    bool useSummaryFile = !summaryCacheFile.empty() && ReuseCallSummaries;
+    if (useSummaryFile) {
+      // 文件损坏时从空的缓存开始，结束时覆盖掉
+      if (!summaryFile.load(summaryCacheFile, errs())) {
+        summaryFile = SummaryFile();
+      }
+      summaries.attachStore(&summaryFile, &codec);
+    }
+
+    StateArena arena;
+    ArenaScope arenaScope(arena);
+    PointToVisitor visitor(&context); // 所有入口的调用结果汇总在一起
+    ResultSnapshotBuilder snapshot;
+    bool buildSnapshot = !SnapshotPath.empty() || snapshotData;
+    std::unique_ptr<ResultWriter> writer =
+        ResultWriter::create(ResultFormat, *out);
+    // 已经输出的调用点和当时的被调函数个数、是否是近似结果
+    std::map<CallInst *, std::pair<size_t, bool>> written;
+
+    writer->setAddressTakenIndex(&addressTaken);
+
+    for (Function *f : collectRoots(M, addressTaken)) {
+      // {basicblock: (pts_in, pts_out)}
+      DataflowResult<PointToSets>::Type result;
+      PointToSets initval;
+
+      if (f->isMaterializable() && context.materialize) {
+        context.materialize(f);
+      }
+      if (f->empty()) {
+        errs() << "Warning: failed to load entry function " << f->getName()
+               << ", skipped.\n";
+        continue;
+      }
+
+      // 入口函数的形参没有绑定，它们自己就代表调用者传进来的对象
+      LOG_INFO(LogCall, "Entry function: " << f->getName());
+      if (isStatsEnabled()) {
+        stats.functions[f].analyses++;
+      }
+      TraceWriter *trace = TraceWriter::get();
+      uint64_t start = trace ? TraceWriter::now() : 0;
+      compForwardDataflow(f, &visitor, &result, initval);
+      if (trace) {
+        trace->complete(f->getName(), "function", start,
+                        [](json::OStream &json) { json.attribute("depth", 0); });
+      }
 
-    DataflowResult<PointToSets>::Type result; // {basicblock: (pts_in, pts_out)}
-    PointToVisitor visitor;
-    PointToSets initval;
+      // 被调函数集合只会增大，个数没变就是没有变化
+      std::vector<CallInst *> changed;
+      for (const auto &entry : visitor.callSiteTargets) {
+        std::pair<size_t, bool> current(
+            entry.second.size(), visitor.degradedCalls.count(entry.first) > 0);
+        auto iter = written.find(entry.first);
+        if (iter == written.end() || iter->second != current) {
+          changed.push_back(entry.first);
+          written[entry.first] = current;
+        }
+      }
+      std::stable_sort(changed.begin(), changed.end(),
+                       ResultWriter::compareLocation);
+      for (CallInst *call : changed) {
+        writer->writeCallSite(f, call, visitor.callSiteTargets[call],
+                              written[call].second);
+      }
 
-    // 假设最后一个函数是程序的入口函数
-    auto f = M.rbegin(), e = M.rend();
-    for (; (f->isIntrinsic() || f->size() == 0) && f != e; f++) {
+      if (SnapshotPointsTo && buildSnapshot) {
+        for (const auto &entry : result[&f->back()].second.getPointToSets()) {
+          snapshot.addPointsTo(entry.first, entry.second);
+        }
+      }
     }
 
-    LOG_DEBUG("Entry function: " << f->getName());
-    compForwardDataflow(&*f, &visitor, &result, initval);
+    if (useSummaryFile) {
+      summaryFile.save(summaryCacheFile, errs());
+    }
+    if (uint64_t degraded = budget.getTotalDegraded()) {
+      errs() << "Warning: analysis budget exceeded in "
+             << M.getModuleIdentifier() << ", " << degraded
+             << " call(s) approximated (";
+      const char *separator = "";
+      for (unsigned i = 1; i < unsigned(BudgetKind::NumKinds); i++) {
+        if (uint64_t count = budget.getDegraded(BudgetKind(i))) {
+          errs() << separator << getBudgetName(BudgetKind(i)) << ": " << count;
+          separator = ", ";
+        }
+      }
+      errs() << ")\n";
+    }
+    if (isStatsEnabled()) {
+      for (unsigned i = 0; i < unsigned(BudgetKind::NumKinds); i++) {
+        stats.approximatedCalls[i] = budget.getDegraded(BudgetKind(i));
+      }
+      stats.degradedCallSites = visitor.degradedCalls.size();
+      StatsReport::get().addModule(M, stats);
+    }
+    analysisTimer.reset();
 
-    LOG_DEBUG("Results: ");
-    visitor.printResults(errs());
+    PhaseTimer outputTimer("output");
+    if (buildSnapshot) {
+      for (const auto &entry : visitor.callSiteTargets) {
+        snapshot.addCallSite(entry.first, entry.second);
+      }
+      if (!SnapshotPath.empty()) {
+        snapshot.write(getSnapshotFile(M), errs());
+      }
+      if (snapshotData) {
+        *snapshotData = snapshot.build();
+      }
+    }
 
+    writer->finish();
+    // 结构化的输出中不能混入文本
+    if (PrintModRef) {
+      modRefSummary.print(ResultFormat == OutputFormat::Text ? *out : errs());
+    }
+
+    callTargets = std::move(visitor.callSiteTargets);
+    openCalls = std::move(visitor.openCalls);
     return false;
   }
+
+private:
+  ModRefSummary modRefSummary;
+  CallTargetMap callTargets;
+  std::set<CallInst *> openCalls;
+  raw_ostream *out;
+  std::function<void(Function *)> materialize;
+  std::string *snapshotData = nullptr;
+
+  ///
+  /// 选出分析的入口函数：
+  /// 用户给出了 -entry 时就使用这些函数；-whole-module 模式下依次是 main、所有外部可见的
+  /// 函数和所有被取过地址的函数；否则假设最后一个有函数体的函数是程序的入口函数。
+  /// 懒加载模式下没有读入的函数体中对函数地址的使用是看不到的，这样的函数只有在
+  /// 分析过程中通过函数指针到达时才会被分析
+  ///
+  static std::vector<Function *>
+  collectRoots(Module &M, const AddressTakenIndex &addressTaken) {
+    std::vector<Function *> roots;
+    auto addRoot = [&roots](Function *F) {
+      if (std::find(roots.begin(), roots.end(), F) == roots.end()) {
+        roots.push_back(F);
+      }
+    };
+
+    if (!EntryFunctions.empty()) {
+      for (const std::string &name : EntryFunctions) {
+        Function *F = M.getFunction(name);
+        if (!F || F->isDeclaration()) {
+          errs() << "Warning: entry function " << name
+                 << " is not defined in the module, skipped.\n";
+          continue;
+        }
+        addRoot(F);
+      }
+      return roots;
+    }
+
+    if (WholeModule) {
+      Function *main = M.getFunction("main");
+      if (main && !main->isDeclaration()) {
+        addRoot(main);
+      }
+      for (Function &F : M) {
+        if (F.isDeclaration() || F.isIntrinsic()) {
+          continue;
+        }
+        if (!F.hasLocalLinkage() || addressTaken.isAddressTaken(&F)) {
+          addRoot(&F);
+        }
+      }
+      return roots;
+    }
+
+    for (auto f = M.rbegin(), e = M.rend(); f != e; f++) {
+      if (!f->isIntrinsic() && !f->isDeclaration()) {
+        addRoot(&*f);
+        break;
+      }
+    }
+    return roots;
+  }
 };
 
 } // end of anonymous namespace
@@ -0,0 +1,297 @@
+#ifndef QUERY_SERVER_H
+#define QUERY_SERVER_H
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/ThreadPool.h>
+#include <llvm/Support/raw_ostream.h>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "ResultSnapshot.h"
+
+using namespace llvm;
+
+///
+/// 常驻的查询服务
+///
+/// 启动时分析一次模块，之后通过 Unix 域套接字回答查询。每个连接有自己的线程读请求，
+/// 请求交给线程池处理，空闲的连接不会占住线程池。一行一个请求、一行一个回答：
+///
+///   callees <file>:<line>[:<column>]  调用点可能调用的函数
+///   pts <value>                       值的指向集，值的写法与 -dump-snapshot 相同
+///   alias <value> <value>             两个值是否可能指向同一个对象
+///   reload                            重新读入并分析模块
+///   shutdown                          停止服务，断开所有连接
+///
+/// 查询只读当前的快照，持有共享锁，可以并行；reload 在锁外完成分析，
+/// 只在替换快照时持有独占锁，正在进行的查询不会被一次重新分析阻塞太久。
+///
+class QueryServer {
+public:
+  /// 读入并分析模块，返回结果快照，失败时返回空指针并把错误写到 err
+  typedef std::function<std::unique_ptr<ResultSnapshot>(raw_ostream &err)>
+      LoadFn;
+
+  QueryServer(LoadFn load, ThreadPoolStrategy strategy)
+      : load(std::move(load)), pool(strategy) {}
+
+  ~QueryServer() {
+    if (listenFd >= 0) {
+      close(listenFd);
+      unlink(socketPath.c_str());
+    }
+  }
+
+  /// 分析模块并在 path 上监听，直到收到 shutdown 请求
+  /// @return 出错时返回 false，错误信息写到 err
+  bool run(StringRef path, raw_ostream &err) {
+    snapshot = load(err);
+    if (!snapshot) {
+      return false;
+    }
+
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+      err << path << ": socket path is too long\n";
+      return false;
+    }
+    std::copy(path.begin(), path.end(), addr.sun_path);
+    listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd < 0) {
+      err << "socket: " << strerror(errno) << "\n";
+      return false;
+    }
+    socketPath = path.str();
+    unlink(socketPath.c_str()); // 上次异常退出时留下的套接字文件
+    if (bind(listenFd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) <
+            0 ||
+        listen(listenFd, SOMAXCONN) < 0) {
+      err << path << ": " << strerror(errno) << "\n";
+      return false;
+    }
+    err << "Listening on " << path << "\n";
+
+    while (!stopping) {
+      int fd = accept(listenFd, nullptr, nullptr);
+      if (fd < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        break; // shutdown 关闭了监听的套接字
+      }
+      std::lock_guard<std::mutex> lock(connectionsMutex);
+      connections.insert(fd);
+      std::thread([this, fd]() {
+        serveConnection(fd);
+        std::lock_guard<std::mutex> lock(connectionsMutex);
+        connections.erase(fd);
+        close(fd);
+        connectionsDone.notify_all();
+      }).detach();
+    }
+
+    // 断开还没有关闭的连接，等待它们的线程退出
+    std::unique_lock<std::mutex> lock(connectionsMutex);
+    for (int fd : connections) {
+      ::shutdown(fd, SHUT_RDWR);
+    }
+    connectionsDone.wait(lock, [this]() { return connections.empty(); });
+    lock.unlock();
+    pool.wait();
+    return true;
+  }
+
+private:
+  LoadFn load;
+  ThreadPool pool;
+  int listenFd = -1;
+  std::string socketPath;
+  std::atomic<bool> stopping{false};
+
+  std::shared_timed_mutex snapshotMutex; // 保护 snapshot 指针
+  std::shared_ptr<const ResultSnapshot> snapshot;
+  std::mutex reloadMutex; // 同一时刻只进行一次重新分析
+
+  std::mutex connectionsMutex; // 保护 connections
+  std::set<int> connections;   // 打开着的连接
+  std::condition_variable connectionsDone;
+
+  void serveConnection(int fd) {
+    std::string buffer;
+    char chunk[4096];
+    while (true) {
+      size_t newline;
+      while ((newline = buffer.find('\n')) == std::string::npos) {
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n < 0 && errno == EINTR) {
+          continue;
+        }
+        if (n <= 0) {
+          return;
+        }
+        buffer.append(chunk, n);
+      }
+      std::string request = buffer.substr(0, newline);
+      buffer.erase(0, newline + 1);
+      // 先回答再停止，停止时会断开包括这个连接在内的所有连接
+      if (StringRef(request).trim() == "shutdown") {
+        sendAll(fd, "ok\n");
+        stopping = true;
+        ::shutdown(listenFd, SHUT_RDWR);
+        return;
+      }
+      std::string reply =
+          pool.async([this, &request]() { return handleRequest(request); })
+              .get();
+      reply += "\n";
+      if (!sendAll(fd, reply)) {
+        return;
+      }
+    }
+  }
+
+  static bool sendAll(int fd, StringRef data) {
+    while (!data.empty()) {
+      ssize_t n = send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        return false;
+      }
+      data = data.drop_front(n);
+    }
+    return true;
+  }
+
+  std::string handleRequest(StringRef line) {
+    SmallVector<StringRef, 4> args;
+    line.trim().split(args, ' ', -1, false);
+    if (args.empty()) {
+      return "error: empty request";
+    }
+    StringRef command = args[0];
+    if (command == "reload" && args.size() == 1) {
+      return reload();
+    }
+
+    // 只拿到快照的引用就释放锁，reload 替换快照时旧的快照在最后一个查询结束后释放
+    std::shared_ptr<const ResultSnapshot> current;
+    {
+      std::shared_lock<std::shared_timed_mutex> lock(snapshotMutex);
+      current = snapshot;
+    }
+    if (command == "callees" && args.size() == 2) {
+      return callees(*current, args[1]);
+    }
+    if (command == "pts" && args.size() == 2) {
+      return pointsTo(*current, args[1]);
+    }
+    if (command == "alias" && args.size() == 3) {
+      return mayAlias(*current, args[1], args[2]);
+    }
+    return "error: unknown request";
+  }
+
+  std::string reload() {
+    std::lock_guard<std::mutex> reloadLock(reloadMutex);
+    std::string errors;
+    raw_string_ostream err(errors);
+    std::shared_ptr<const ResultSnapshot> loaded = load(err);
+    if (!loaded) {
+      err.flush();
+      StringRef message = StringRef(errors).trim();
+      return "error: " + message.substr(0, message.find('\n')).str();
+    }
+    std::unique_lock<std::shared_timed_mutex> lock(snapshotMutex);
+    snapshot = std::move(loaded);
+    return "ok";
+  }
+
+  /// 位置的格式是 file:line 或者 file:line:column
+  static std::string callees(const ResultSnapshot &result, StringRef location) {
+    StringRef file, tail, prefix, lineText;
+    std::tie(file, tail) = location.rsplit(':');
+    std::tie(prefix, lineText) = file.rsplit(':');
+    unsigned line = 0, column = 0;
+    if (!lineText.empty() && !lineText.getAsInteger(10, line)) {
+      // file:line:column
+      file = prefix;
+      if (tail.getAsInteger(10, column)) {
+        return "error: bad location";
+      }
+    } else if (tail.getAsInteger(10, line)) {
+      return "error: bad location";
+    }
+    if (file.empty() || line == 0) {
+      return "error: bad location";
+    }
+
+    std::set<StringRef> names;
+    auto range = result.findCallSites(file, line);
+    for (unsigned i = range.first; i < range.second; i++) {
+      if (column && result.getCallSites()[i].column != column) {
+        continue;
+      }
+      for (uint32_t callee : result.getCallees(i)) {
+        names.insert(result.getString(result.getFunctions()[callee].name));
+      }
+    }
+    return join(names.begin(), names.end(), " ");
+  }
+
+  static std::string pointsTo(const ResultSnapshot &result, StringRef value) {
+    unsigned index;
+    if (!result.findPointsTo(value, index)) {
+      return "error: unknown value";
+    }
+    std::vector<StringRef> names;
+    for (uint32_t target : result.getTargets(index)) {
+      names.push_back(result.getString(target));
+    }
+    return join(names.begin(), names.end(), " ");
+  }
+
+  /// 两个值的指向集有交集时可能是别名，目标都是按下标排好序的
+  static std::string mayAlias(const ResultSnapshot &result, StringRef a,
+                              StringRef b) {
+    unsigned indexA, indexB;
+    if (!result.findPointsTo(a, indexA) || !result.findPointsTo(b, indexB)) {
+      return "error: unknown value";
+    }
+    ArrayRef<snapshot::Word> targetsA = result.getTargets(indexA);
+    ArrayRef<snapshot::Word> targetsB = result.getTargets(indexB);
+    auto iterA = targetsA.begin(), iterB = targetsB.begin();
+    while (iterA != targetsA.end() && iterB != targetsB.end()) {
+      if (*iterA == *iterB) {
+        return "yes";
+      }
+      if (*iterA < *iterB) {
+        ++iterA;
+      } else {
+        ++iterB;
+      }
+    }
+    return "no";
+  }
+};
+
+#endif // QUERY_SERVER_H
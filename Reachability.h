@@ -0,0 +1,270 @@
+#ifndef REACHABILITY_H
+#define REACHABILITY_H
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/BitVector.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/IR/Value.h>
+#include <algorithm>
+#include <vector>
+
+using namespace llvm;
+
+///
+/// 指向图上的可达性索引
+///
+/// 结点是状态中出现的值，边 v -> w 表示 w 属于 v 的指向集。建立索引时用 Tarjan
+/// 算法把强连通分量缩成一个点，每个分量的闭包在第一次被查询时计算并缓存，
+/// 之后同一个状态（以及它的拷贝）上的所有查询都可以共享这些结果。
+///
+/// 状态修改后不必从头重建：只有能到达被修改结点的分量的闭包会失效，
+/// 其余分量的闭包可以直接沿用到新的索引中。
+///
+class ReachabilityIndex {
+public:
+  template <class GraphMap> explicit ReachabilityIndex(const GraphMap &graph) {
+    build(graph, nullptr, None);
+  }
+
+  /// 在旧索引的基础上建立新索引，dirty 是旧索引建立以后出边发生过变化的结点
+  template <class GraphMap>
+  ReachabilityIndex(const GraphMap &graph, const ReachabilityIndex &old,
+                    ArrayRef<Value *> dirty) {
+    build(graph, &old, dirty);
+  }
+
+  unsigned getNumNodes() const { return nodes.size(); }
+
+  Value *getNode(unsigned id) const { return nodes[id]; }
+
+  ///
+  /// 把从 roots 出发可达的结点（包括 roots 本身）并入 reached，位下标就是结点编号。
+  /// 不在图中的根没有出边，会被忽略。
+  ///
+  template <class Range>
+  void addReachable(const Range &roots, BitVector &reached) const {
+    if (reached.size() < nodes.size()) {
+      reached.resize(nodes.size());
+    }
+    for (Value *root : roots) {
+      auto iter = ids.find(root);
+      if (iter == ids.end()) {
+        continue;
+      }
+      reached |= getClosure(sccOf[iter->second]);
+    }
+  }
+
+private:
+  DenseMap<Value *, unsigned> ids;
+  std::vector<Value *> nodes;
+  std::vector<SmallVector<unsigned, 4>> preds; // 反向边，用于增量更新
+
+  std::vector<unsigned> sccOf;
+  std::vector<SmallVector<unsigned, 2>> sccMembers;
+  // 缩点之后的边，Tarjan 算法保证后继分量的编号总是比自己小
+  std::vector<SmallVector<unsigned, 4>> sccSuccs;
+
+  // 分量的闭包，按需计算
+  mutable std::vector<BitVector> closures;
+  mutable BitVector hasClosure;
+
+  unsigned getId(Value *v) {
+    auto result = ids.insert(std::make_pair(v, (unsigned)nodes.size()));
+    if (result.second) {
+      nodes.push_back(v);
+    }
+    return result.first->second;
+  }
+
+  template <class GraphMap>
+  void build(const GraphMap &graph, const ReachabilityIndex *old,
+             ArrayRef<Value *> dirty) {
+    // 沿用旧索引的结点编号，保证缓存的闭包在新索引里仍然有效
+    if (old) {
+      ids = old->ids;
+      nodes = old->nodes;
+    }
+
+    std::vector<SmallVector<unsigned, 4>> succs;
+    for (const auto &entry : graph) {
+      unsigned from = getId(entry.first);
+      for (Value *v : entry.second) {
+        unsigned to = getId(v);
+        if (succs.size() <= std::max(from, to)) {
+          succs.resize(nodes.size());
+        }
+        succs[from].push_back(to);
+      }
+    }
+    unsigned n = nodes.size();
+    succs.resize(n);
+    preds.assign(n, {});
+    for (unsigned from = 0; from < n; from++) {
+      for (unsigned to : succs[from]) {
+        preds[to].push_back(from);
+      }
+    }
+
+    computeSCCs(succs);
+
+    closures.assign(sccMembers.size(), BitVector());
+    hasClosure.clear();
+    hasClosure.resize(sccMembers.size());
+    if (old) {
+      reuseClosures(*old, dirty);
+    }
+  }
+
+  /// 迭代版的 Tarjan 算法，避免深的指向链导致栈溢出
+  void computeSCCs(const std::vector<SmallVector<unsigned, 4>> &succs) {
+    const unsigned Unvisited = ~0U;
+    unsigned n = nodes.size();
+    std::vector<unsigned> index(n, Unvisited), lowlink(n, 0);
+    std::vector<bool> onStack(n, false);
+    std::vector<unsigned> stack;
+    std::vector<std::pair<unsigned, unsigned>> callStack; // (结点, 下一条边)
+    unsigned counter = 0;
+
+    sccOf.assign(n, 0);
+    sccMembers.clear();
+    sccSuccs.clear();
+
+    for (unsigned start = 0; start < n; start++) {
+      if (index[start] != Unvisited) {
+        continue;
+      }
+      callStack.push_back(std::make_pair(start, 0));
+      index[start] = lowlink[start] = counter++;
+      stack.push_back(start);
+      onStack[start] = true;
+
+      while (!callStack.empty()) {
+        unsigned v = callStack.back().first;
+        unsigned &edge = callStack.back().second;
+        if (edge < succs[v].size()) {
+          unsigned w = succs[v][edge++];
+          if (index[w] == Unvisited) {
+            index[w] = lowlink[w] = counter++;
+            stack.push_back(w);
+            onStack[w] = true;
+            callStack.push_back(std::make_pair(w, 0));
+          } else if (onStack[w]) {
+            lowlink[v] = std::min(lowlink[v], index[w]);
+          }
+          continue;
+        }
+
+        callStack.pop_back();
+        if (!callStack.empty()) {
+          unsigned parent = callStack.back().first;
+          lowlink[parent] = std::min(lowlink[parent], lowlink[v]);
+        }
+        if (lowlink[v] != index[v]) {
+          continue;
+        }
+
+        // v 是一个强连通分量的根，分量的所有后继分量都已经编号
+        unsigned scc = sccMembers.size();
+        sccMembers.emplace_back();
+        sccSuccs.emplace_back();
+        unsigned w;
+        do {
+          w = stack.back();
+          stack.pop_back();
+          onStack[w] = false;
+          sccOf[w] = scc;
+          sccMembers[scc].push_back(w);
+        } while (w != v);
+
+        for (unsigned member : sccMembers[scc]) {
+          for (unsigned succ : succs[member]) {
+            unsigned target = sccOf[succ];
+            if (target != scc) {
+              sccSuccs[scc].push_back(target);
+            }
+          }
+        }
+        std::sort(sccSuccs[scc].begin(), sccSuccs[scc].end());
+        sccSuccs[scc].erase(
+            std::unique(sccSuccs[scc].begin(), sccSuccs[scc].end()),
+            sccSuccs[scc].end());
+      }
+    }
+  }
+
+  ///
+  /// 不能到达任何 dirty 结点的结点，它可达的子图没有发生变化，所在的分量和闭包也不变，
+  /// 直接把旧索引里已经算好的闭包搬过来
+  ///
+  void reuseClosures(const ReachabilityIndex &old, ArrayRef<Value *> dirty) {
+    unsigned oldSize = old.nodes.size();
+    BitVector affected(oldSize);
+    std::vector<unsigned> worklist;
+    for (Value *v : dirty) {
+      auto iter = old.ids.find(v);
+      if (iter != old.ids.end() && !affected.test(iter->second)) {
+        affected.set(iter->second);
+        worklist.push_back(iter->second);
+      }
+    }
+    while (!worklist.empty()) {
+      unsigned v = worklist.back();
+      worklist.pop_back();
+      for (unsigned pred : old.preds[v]) {
+        if (!affected.test(pred)) {
+          affected.set(pred);
+          worklist.push_back(pred);
+        }
+      }
+    }
+
+    for (unsigned scc = 0; scc < sccMembers.size(); scc++) {
+      unsigned member = sccMembers[scc].front();
+      if (member >= oldSize || affected.test(member)) {
+        continue;
+      }
+      unsigned oldSCC = old.sccOf[member];
+      if (old.hasClosure.test(oldSCC)) {
+        closures[scc] = old.closures[oldSCC];
+        closures[scc].resize(nodes.size());
+        hasClosure.set(scc);
+      }
+    }
+  }
+
+  const BitVector &getClosure(unsigned scc) const {
+    SmallVector<unsigned, 16> worklist = {scc};
+    while (!worklist.empty()) {
+      unsigned current = worklist.back();
+      if (hasClosure.test(current)) {
+        worklist.pop_back();
+        continue;
+      }
+      bool ready = true;
+      for (unsigned succ : sccSuccs[current]) {
+        if (!hasClosure.test(succ)) {
+          worklist.push_back(succ);
+          ready = false;
+        }
+      }
+      if (!ready) {
+        continue;
+      }
+      worklist.pop_back();
+      BitVector closure(nodes.size());
+      for (unsigned member : sccMembers[current]) {
+        closure.set(member);
+      }
+      for (unsigned succ : sccSuccs[current]) {
+        closure |= closures[succ];
+      }
+      closures[current] = std::move(closure);
+      hasClosure.set(current);
+    }
+    return closures[scc];
+  }
+};
+
+#endif // REACHABILITY_H
@@ -0,0 +1,571 @@
+#ifndef RESULT_SNAPSHOT_H
+#define RESULT_SNAPSHOT_H
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/IR/DebugInfoMetadata.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/Endian.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MD5.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <tuple>
+#include <vector>
+
+using namespace llvm;
+
+static cl::opt<std::string> SnapshotPath(
+    "snapshot",
+    cl::desc("Write the analysis results to this file in the binary snapshot "
+             "format (or one file per module if it is a directory)"),
+    cl::value_desc("path"), cl::init(""));
+
+static cl::opt<bool>
+    SnapshotPointsTo("snapshot-pts",
+                     cl::desc("Also store the points-to sets at the exit of "
+                              "each entry function in the snapshot"),
+                     cl::init(false));
+
+///
+/// 结果快照的文件格式
+///
+/// 所有整数都是 4 字节小端序，文件依次是：文件头、字符串偏移、字符串内容（补齐到 4 字节）、
+/// 函数表、调用点表、调用点的被调函数（CSR：偏移数组加下标数组）、指向集（同样是 CSR）。
+/// 字符串表去重并按字典序排列，字符串下标的顺序就是字符串的顺序；函数表按函数名排列，
+/// 调用点表按（文件、行、列）排列，都可以直接二分查找。每个调用点的被调函数和
+/// 每个指向集中的对象也按下标排好序，求交集只需要一次归并。
+///
+namespace snapshot {
+
+typedef support::ulittle32_t Word;
+
+static constexpr char Magic[8] = {'P', 'T', 'S', 'N', 'A', 'P', 'v', '1'};
+static const uint32_t NoFunction = ~0u;
+
+struct Header {
+  char magic[8];
+  Word numStrings, stringOffsets, stringData, stringDataSize;
+  Word numFunctions, functions;
+  Word numCallSites, callSites, calleeOffsets, callees;
+  Word numPointsTo, pointsTo, targetOffsets, targets;
+};
+
+struct FunctionEntry {
+  Word name; // 字符串下标
+  Word file; // 字符串下标，没有调试信息时是空字符串
+  Word line;
+};
+
+struct CallSiteEntry {
+  Word file;
+  Word line;
+  Word column;
+  Word caller; // 函数表下标
+};
+
+struct PointsToEntry {
+  Word function; // 局部值所在的函数，全局值为 NoFunction
+  Word name;     // 字符串下标
+};
+
+} // namespace snapshot
+
+///
+/// 在分析过程中收集结果，最后一次性写成快照文件
+///
+class ResultSnapshotBuilder {
+public:
+  void addCallSite(CallInst *call, const std::set<Function *> &callees) {
+    callSites[call].insert(callees.begin(), callees.end());
+  }
+
+  /// 记录 value 指向 targets，同一个值多次记录时取并集
+  template <class Set> void addPointsTo(Value *value, const Set &targets) {
+    std::set<std::string> &names =
+        pointsTo[ValueName(getFunction(value), describe(value))];
+    for (Value *target : targets) {
+      names.insert(describe(target));
+    }
+  }
+
+  /// 快照文件的完整内容
+  std::string build() const {
+    // 先收集所有字符串和函数，排好序以后才能确定下标
+    std::set<std::string> strings = {""};
+    std::set<Function *> functions;
+    for (const auto &entry : callSites) {
+      functions.insert(entry.first->getFunction());
+      functions.insert(entry.second.begin(), entry.second.end());
+      strings.insert(getFile(entry.first->getDebugLoc().get()));
+    }
+    for (const auto &entry : pointsTo) {
+      if (entry.first.first) {
+        functions.insert(entry.first.first);
+      }
+      strings.insert(entry.first.second);
+      strings.insert(entry.second.begin(), entry.second.end());
+    }
+    for (Function *func : functions) {
+      strings.insert(func->getName().str());
+      strings.insert(getFile(func->getSubprogram()));
+    }
+    StringMap<uint32_t> stringIds;
+    for (const std::string &s : strings) {
+      uint32_t id = stringIds.size();
+      stringIds[s] = id;
+    }
+
+    std::vector<Function *> functionList(functions.begin(), functions.end());
+    std::sort(functionList.begin(), functionList.end(),
+              [](Function *a, Function *b) {
+                return a->getName() < b->getName();
+              });
+    std::map<Function *, uint32_t> functionIds;
+    for (uint32_t id = 0; id < functionList.size(); id++) {
+      functionIds[functionList[id]] = id;
+    }
+
+    typedef std::tuple<uint32_t, unsigned, unsigned, uint32_t, CallInst *>
+        CallSiteKey;
+    std::vector<CallSiteKey> callSiteList;
+    for (const auto &entry : callSites) {
+      const DILocation *loc = entry.first->getDebugLoc().get();
+      callSiteList.emplace_back(
+          stringIds[getFile(loc)], loc ? loc->getLine() : 0,
+          loc ? loc->getColumn() : 0,
+          functionIds.at(entry.first->getFunction()), entry.first);
+    }
+    std::sort(callSiteList.begin(), callSiteList.end());
+
+    // 全局值排在最前面，局部值按所在函数分组
+    typedef std::tuple<uint32_t, uint32_t, const std::set<std::string> *>
+        PointsToKey;
+    std::vector<PointsToKey> pointsToList;
+    for (const auto &entry : pointsTo) {
+      Function *func = entry.first.first;
+      pointsToList.emplace_back(func ? functionIds.at(func)
+                                     : snapshot::NoFunction,
+                                stringIds[entry.first.second], &entry.second);
+    }
+    std::sort(pointsToList.begin(), pointsToList.end(),
+              [](const PointsToKey &a, const PointsToKey &b) {
+                return std::make_pair(std::get<0>(a) + 1, std::get<1>(a)) <
+                       std::make_pair(std::get<0>(b) + 1, std::get<1>(b));
+              });
+
+    std::string data(sizeof(snapshot::Header), '\0');
+    snapshot::Header header;
+    std::copy(std::begin(snapshot::Magic), std::end(snapshot::Magic),
+              header.magic);
+
+    header.numStrings = strings.size();
+    header.stringOffsets = data.size();
+    uint32_t offset = 0;
+    for (const std::string &s : strings) {
+      writeWord(data, offset);
+      offset += s.size();
+    }
+    writeWord(data, offset);
+    header.stringData = data.size();
+    header.stringDataSize = offset;
+    for (const std::string &s : strings) {
+      data += s;
+    }
+    data.resize(alignTo(data.size(), 4), '\0');
+
+    header.numFunctions = functionList.size();
+    header.functions = data.size();
+    for (Function *func : functionList) {
+      const DISubprogram *sp = func->getSubprogram();
+      writeWord(data, stringIds[func->getName()]);
+      writeWord(data, stringIds[getFile(sp)]);
+      writeWord(data, sp ? sp->getLine() : 0);
+    }
+
+    header.numCallSites = callSiteList.size();
+    header.callSites = data.size();
+    for (const CallSiteKey &key : callSiteList) {
+      writeWord(data, std::get<0>(key));
+      writeWord(data, std::get<1>(key));
+      writeWord(data, std::get<2>(key));
+      writeWord(data, std::get<3>(key));
+    }
+    std::vector<uint32_t> callees;
+    header.calleeOffsets = data.size();
+    for (const CallSiteKey &key : callSiteList) {
+      writeWord(data, callees.size());
+      size_t begin = callees.size();
+      for (Function *callee : callSites.at(std::get<4>(key))) {
+        callees.push_back(functionIds.at(callee));
+      }
+      std::sort(callees.begin() + begin, callees.end());
+    }
+    writeWord(data, callees.size());
+    header.callees = data.size();
+    for (uint32_t id : callees) {
+      writeWord(data, id);
+    }
+
+    header.numPointsTo = pointsToList.size();
+    header.pointsTo = data.size();
+    for (const PointsToKey &key : pointsToList) {
+      writeWord(data, std::get<0>(key));
+      writeWord(data, std::get<1>(key));
+    }
+    uint32_t numTargets = 0;
+    header.targetOffsets = data.size();
+    for (const PointsToKey &key : pointsToList) {
+      writeWord(data, numTargets);
+      numTargets += std::get<2>(key)->size();
+    }
+    writeWord(data, numTargets);
+    header.targets = data.size();
+    for (const PointsToKey &key : pointsToList) {
+      for (const std::string &target : *std::get<2>(key)) {
+        writeWord(data, stringIds[target]);
+      }
+    }
+
+    std::memcpy(&data[0], &header, sizeof(header));
+    return data;
+  }
+
+  bool write(StringRef path, raw_ostream &err) const {
+    std::string data = build();
+    // 先写到临时文件再改名，正在映射旧文件的读者不受影响；
+    // 临时文件名是唯一的，同时写同一个快照的进程不会写到一起
+    SmallString<128> tmpPath;
+    int fd;
+    if (std::error_code ec =
+            sys::fs::createUniqueFile(path + "-%%%%%%.tmp", fd, tmpPath)) {
+      err << path << ": " << ec.message() << "\n";
+      return false;
+    }
+    {
+      raw_fd_ostream out(fd, /*shouldClose=*/true);
+      out << data;
+    }
+    if (std::error_code ec = sys::fs::rename(tmpPath, path)) {
+      err << path << ": " << ec.message() << "\n";
+      sys::fs::remove(tmpPath);
+      return false;
+    }
+    return true;
+  }
+
+private:
+  // （所在函数，值的名字），全局值所在的函数为空
+  typedef std::pair<Function *, std::string> ValueName;
+
+  std::map<CallInst *, std::set<Function *>> callSites;
+  std::map<ValueName, std::set<std::string>> pointsTo;
+
+  static Function *getFunction(Value *value) {
+    if (Instruction *inst = dyn_cast<Instruction>(value)) {
+      return inst->getFunction();
+    }
+    if (Argument *arg = dyn_cast<Argument>(value)) {
+      return arg->getParent();
+    }
+    return nullptr;
+  }
+
+  /// 全局值是 @name，局部值是 函数名:%name
+  static std::string describe(Value *value) {
+    std::string name;
+    raw_string_ostream os(name);
+    if (Function *func = getFunction(value)) {
+      os << func->getName() << ":";
+    }
+    value->printAsOperand(os, false);
+    return os.str();
+  }
+
+  static std::string getFile(const DIScope *scope) {
+    return scope ? scope->getFilename().str() : "";
+  }
+
+  static std::string getFile(const DILocation *loc) {
+    return loc ? loc->getFilename().str() : "";
+  }
+
+  static void writeWord(std::string &data, uint32_t value) {
+    char bytes[4];
+    support::endian::write32le(bytes, value);
+    data.append(bytes, 4);
+  }
+};
+
+///
+/// 通过内存映射打开的结果快照，所有查询都直接读映射的内存，不做任何解码和拷贝
+///
+class ResultSnapshot {
+public:
+  /// @return 文件不存在或者格式不对时返回空指针，错误信息写到 err
+  static std::unique_ptr<ResultSnapshot> open(StringRef path,
+                                              raw_ostream &err) {
+    auto file = MemoryBuffer::getFile(path, /*IsText=*/false,
+                                      /*RequiresNullTerminator=*/false);
+    if (!file) {
+      err << path << ": " << file.getError().message() << "\n";
+      return nullptr;
+    }
+    std::unique_ptr<ResultSnapshot> result = create(std::move(*file));
+    if (!result) {
+      err << path << ": not a valid result snapshot\n";
+    }
+    return result;
+  }
+
+  /// 从已经在内存中的快照创建，快照保存 buffer 直到析构
+  /// @return 格式不对时返回空指针
+  static std::unique_ptr<ResultSnapshot>
+  create(std::unique_ptr<MemoryBuffer> buffer) {
+    std::unique_ptr<ResultSnapshot> result(new ResultSnapshot());
+    result->buffer = std::move(buffer);
+    if (!result->parse()) {
+      return nullptr;
+    }
+    return result;
+  }
+
+  unsigned getNumStrings() const { return stringOffsets.size() - 1; }
+
+  StringRef getString(uint32_t id) const {
+    return stringData.slice(stringOffsets[id], stringOffsets[id + 1]);
+  }
+
+  ArrayRef<snapshot::FunctionEntry> getFunctions() const { return functions; }
+  ArrayRef<snapshot::CallSiteEntry> getCallSites() const { return callSites; }
+  ArrayRef<snapshot::PointsToEntry> getPointsTo() const { return pointsTo; }
+
+  /// 第 i 个调用点可能调用的函数，是函数表的下标
+  ArrayRef<snapshot::Word> getCallees(unsigned i) const {
+    return callees.slice(calleeOffsets[i],
+                         calleeOffsets[i + 1] - calleeOffsets[i]);
+  }
+
+  /// 第 i 个指向集中的对象，是字符串下标
+  ArrayRef<snapshot::Word> getTargets(unsigned i) const {
+    return targets.slice(targetOffsets[i],
+                         targetOffsets[i + 1] - targetOffsets[i]);
+  }
+
+  /// @return 字符串不在表中时返回 false
+  bool findString(StringRef s, uint32_t &id) const {
+    uint32_t lo = 0, hi = getNumStrings();
+    while (lo < hi) {
+      uint32_t mid = lo + (hi - lo) / 2;
+      if (getString(mid) < s) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    id = lo;
+    return lo < getNumStrings() && getString(lo) == s;
+  }
+
+  /// 按函数名二分查找函数表
+  /// @return 没有这个函数时返回 false
+  bool findFunction(StringRef name, uint32_t &id) const {
+    auto iter = std::lower_bound(
+        functions.begin(), functions.end(), name,
+        [this](const snapshot::FunctionEntry &e, StringRef name) {
+          return getString(e.name) < name;
+        });
+    id = iter - functions.begin();
+    return iter != functions.end() && getString(iter->name) == name;
+  }
+
+  /// 按值的名字（@global 或者 函数名:%local）查找它的指向集
+  /// @return 快照中没有这个值时返回 false
+  bool findPointsTo(StringRef name, unsigned &index) const {
+    uint32_t nameId, function = snapshot::NoFunction;
+    if (!findString(name, nameId)) {
+      return false;
+    }
+    size_t colon = name.find(':');
+    if (!name.startswith("@") && colon != StringRef::npos &&
+        !findFunction(name.take_front(colon), function)) {
+      return false;
+    }
+    // 与写入时的顺序一致：全局值在前，局部值按所在函数、再按名字排列
+    auto key = [](uint32_t function, uint32_t name) {
+      return std::make_pair(function + 1, name);
+    };
+    auto iter = std::lower_bound(
+        pointsTo.begin(), pointsTo.end(), key(function, nameId),
+        [&key](const snapshot::PointsToEntry &e,
+               std::pair<uint32_t, uint32_t> k) {
+          return key(e.function, e.name) < k;
+        });
+    index = iter - pointsTo.begin();
+    return iter != pointsTo.end() && iter->name == nameId;
+  }
+
+  /// 文件 file 第 line 行（line 为 0 时是整个文件）上的所有调用点，返回调用点表的下标范围
+  std::pair<unsigned, unsigned> findCallSites(StringRef file,
+                                              unsigned line = 0) const {
+    uint32_t fileId;
+    if (!findString(file, fileId)) {
+      return {0, 0};
+    }
+    auto key = [](const snapshot::CallSiteEntry &e) {
+      return std::make_pair(uint32_t(e.file), uint32_t(e.line));
+    };
+    auto lower = std::make_pair(fileId, uint32_t(line));
+    auto upper = std::make_pair(fileId, line ? uint32_t(line) : ~0u);
+    auto begin = std::lower_bound(
+        callSites.begin(), callSites.end(), lower,
+        [&key](const snapshot::CallSiteEntry &e,
+               std::pair<uint32_t, uint32_t> k) { return key(e) < k; });
+    auto end = std::upper_bound(
+        begin, callSites.end(), upper,
+        [&key](std::pair<uint32_t, uint32_t> k,
+               const snapshot::CallSiteEntry &e) { return k < key(e); });
+    return {unsigned(begin - callSites.begin()),
+            unsigned(end - callSites.begin())};
+  }
+
+  void print(raw_ostream &out) const {
+    for (unsigned i = 0; i < callSites.size(); i++) {
+      const snapshot::CallSiteEntry &site = callSites[i];
+      out << getString(site.file) << ":" << site.line << ":" << site.column
+          << " in " << getString(functions[site.caller].name) << " :";
+      for (uint32_t callee : getCallees(i)) {
+        out << " " << getString(functions[callee].name);
+      }
+      out << "\n";
+    }
+    for (unsigned i = 0; i < pointsTo.size(); i++) {
+      out << getString(pointsTo[i].name) << " ->";
+      for (uint32_t target : getTargets(i)) {
+        out << " " << getString(target);
+      }
+      out << "\n";
+    }
+  }
+
+private:
+  std::unique_ptr<MemoryBuffer> buffer;
+  ArrayRef<snapshot::Word> stringOffsets;
+  StringRef stringData;
+  ArrayRef<snapshot::FunctionEntry> functions;
+  ArrayRef<snapshot::CallSiteEntry> callSites;
+  ArrayRef<snapshot::Word> calleeOffsets, callees;
+  ArrayRef<snapshot::PointsToEntry> pointsTo;
+  ArrayRef<snapshot::Word> targetOffsets, targets;
+
+  ResultSnapshot() {}
+
+  /// 取出文件中 [offset, offset + count * sizeof(T)) 的数组，越界时返回 false。
+  /// count 是 64 位的，头部的个数加 1 时不会回绕成 0
+  template <class T>
+  bool getArray(uint32_t offset, uint64_t count, ArrayRef<T> &array) const {
+    StringRef data = buffer->getBuffer();
+    if (offset > data.size() || count > (data.size() - offset) / sizeof(T)) {
+      return false;
+    }
+    array = makeArrayRef(
+        reinterpret_cast<const T *>(data.data() + offset), count);
+    return true;
+  }
+
+  /// CSR 的偏移数组必须单调不减，并且最后一个偏移不超过下标数组
+  static bool checkOffsets(ArrayRef<snapshot::Word> offsets, size_t size) {
+    for (size_t i = 0; i + 1 < offsets.size(); i++) {
+      if (offsets[i] > offsets[i + 1]) {
+        return false;
+      }
+    }
+    return offsets.front() == 0 && offsets.back() == size;
+  }
+
+  static bool checkIds(ArrayRef<snapshot::Word> ids, uint32_t limit) {
+    return std::all_of(ids.begin(), ids.end(),
+                       [limit](uint32_t id) { return id < limit; });
+  }
+
+  /// 打开时检查一遍所有的偏移和下标，之后的查询不再做边界检查
+  bool parse() {
+    ArrayRef<snapshot::Header> headers;
+    if (!getArray(0, 1, headers) ||
+        !std::equal(std::begin(snapshot::Magic), std::end(snapshot::Magic),
+                    headers[0].magic)) {
+      return false;
+    }
+    const snapshot::Header &h = headers[0];
+    ArrayRef<char> chars;
+    if (h.numStrings == 0 ||
+        !getArray(h.stringOffsets, uint64_t(h.numStrings) + 1,
+                  stringOffsets) ||
+        !getArray(h.stringData, h.stringDataSize, chars) ||
+        !getArray(h.functions, h.numFunctions, functions) ||
+        !getArray(h.callSites, h.numCallSites, callSites) ||
+        !getArray(h.calleeOffsets, uint64_t(h.numCallSites) + 1,
+                  calleeOffsets) ||
+        !getArray(h.pointsTo, h.numPointsTo, pointsTo) ||
+        !getArray(h.targetOffsets, uint64_t(h.numPointsTo) + 1,
+                  targetOffsets) ||
+        !checkOffsets(stringOffsets, chars.size())) {
+      return false;
+    }
+    stringData = StringRef(chars.data(), chars.size());
+    if (!getArray(h.callees, calleeOffsets.back(), callees) ||
+        !getArray(h.targets, targetOffsets.back(), targets) ||
+        !checkOffsets(calleeOffsets, callees.size()) ||
+        !checkOffsets(targetOffsets, targets.size()) ||
+        !checkIds(callees, functions.size()) ||
+        !checkIds(targets, getNumStrings())) {
+      return false;
+    }
+    uint32_t numStrings = getNumStrings();
+    for (const snapshot::FunctionEntry &e : functions) {
+      if (e.name >= numStrings || e.file >= numStrings) {
+        return false;
+      }
+    }
+    for (const snapshot::CallSiteEntry &e : callSites) {
+      if (e.file >= numStrings || e.caller >= functions.size()) {
+        return false;
+      }
+    }
+    for (const snapshot::PointsToEntry &e : pointsTo) {
+      if (e.name >= numStrings || (e.function != snapshot::NoFunction &&
+                                   e.function >= functions.size())) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+///
+/// 模块对应的快照文件：-snapshot 是目录时每个模块一个文件，文件名取自模块来源的哈希，
+/// 不同目录下的同名模块不会写到同一个文件
+///
+inline std::string getSnapshotFile(const Module &M) {
+  if (!sys::fs::is_directory(SnapshotPath)) {
+    return SnapshotPath;
+  }
+  MD5 hash;
+  hash.update(M.getModuleIdentifier());
+  MD5::MD5Result digest;
+  hash.final(digest);
+  SmallString<128> path(SnapshotPath);
+  sys::path::append(path, digest.digest() + ".ptsnap");
+  return path.str().str();
+}
+
+#endif // RESULT_SNAPSHOT_H
@@ -0,0 +1,293 @@
+#ifndef RESULT_WRITER_H
+#define RESULT_WRITER_H
+
+#include <llvm/IR/DebugInfoMetadata.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/raw_ostream.h>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "AddressTakenIndex.h"
+#include "SummaryStore.h"
+
+using namespace llvm;
+
+enum class OutputFormat { Text, JSONLines, Binary };
+
+static cl::opt<OutputFormat> ResultFormat(
+    "output-format", cl::desc("Format of the call-site results"),
+    cl::values(clEnumValN(OutputFormat::Text, "text",
+                          "Callee names grouped by line, printed at the end "
+                          "(default)"),
+               clEnumValN(OutputFormat::JSONLines, "jsonl",
+                          "One JSON object per call site, streamed as each "
+                          "entry function finishes"),
+               clEnumValN(OutputFormat::Binary, "binary",
+                          "Length-prefixed binary records, streamed as each "
+                          "entry function finishes")),
+    cl::init(OutputFormat::Text));
+
+///
+/// 调用点结果的输出
+///
+/// 每个入口函数分析完成后，分析把这个入口新发现的或者被调函数有变化的调用点交给 writer，
+/// 流式的格式立即写出，后来的记录包含这个调用点完整的被调函数集合，覆盖之前的记录。
+/// 所有入口结束后调用 finish。degraded 表示结果来自超出预算后的近似分析。
+///
+class ResultWriter {
+public:
+  virtual ~ResultWriter() {}
+
+  virtual void writeCallSite(Function *root, CallInst *call,
+                             const std::set<Function *> &callees,
+                             bool degraded) = 0;
+
+  virtual void finish() {}
+
+  /// 提供以后，间接调用点的记录中可以附带类型兼容的候选函数个数
+  void setAddressTakenIndex(const AddressTakenIndex *index) {
+    addressTaken = index;
+  }
+
+  /// 输出流的开头，二进制格式在这里写文件头。一个流只写一次，批量分析时所有模块共用
+  static void writeStreamHeader(OutputFormat format, raw_ostream &out);
+
+  /// 批量分析时每个模块的结果之前写一条模块记录，文本格式是 "==> 文件名 <=="
+  static void writeModuleHeader(OutputFormat format, raw_ostream &out,
+                                StringRef file);
+
+  static std::unique_ptr<ResultWriter> create(OutputFormat format,
+                                              raw_ostream &out);
+
+  /// 同一个入口的调用点按（文件、行、列）的顺序输出，与指令在内存中的地址无关
+  static bool compareLocation(CallInst *a, CallInst *b) {
+    const DebugLoc &locA = a->getDebugLoc(), &locB = b->getDebugLoc();
+    auto key = [](CallInst *call, const DebugLoc &loc) {
+      return std::make_tuple(getFile(call), loc ? loc.getLine() : 0,
+                             loc ? loc.getCol() : 0);
+    };
+    return key(a, locA) < key(b, locB);
+  }
+
+protected:
+  const AddressTakenIndex *addressTaken = nullptr;
+
+  /// 间接调用点可能调用的函数个数的上界，直接调用或者索引不完整时返回 0
+  size_t getCandidateBound(CallInst *call) const {
+    if (!addressTaken || !addressTaken->isComplete() ||
+        isa<Function>(call->getCalledOperand()->stripPointerCasts())) {
+      return 0;
+    }
+    return addressTaken->getNumCandidates(call);
+  }
+
+  /// 被调函数按名字排序，输出与函数在内存中的地址无关
+  static std::vector<StringRef>
+  getCalleeNames(const std::set<Function *> &callees) {
+    std::vector<StringRef> names;
+    for (Function *callee : callees) {
+      names.push_back(callee->getName());
+    }
+    std::sort(names.begin(), names.end());
+    names.erase(std::unique(names.begin(), names.end()), names.end());
+    return names;
+  }
+
+  static StringRef getFile(CallInst *call) {
+    const DILocation *loc = call->getDebugLoc().get();
+    return loc ? loc->getFilename() : StringRef();
+  }
+};
+
+///
+/// 原来的文本格式：按行号汇总，不同文件、不同列的调用点合并在同一行，
+/// 需要所有入口结束后才能排好序输出。有近似结果时最后多一行
+/// "degraded : 行号, ..."
+///
+class TextResultWriter : public ResultWriter {
+public:
+  explicit TextResultWriter(raw_ostream &out) : out(out) {}
+
+  void writeCallSite(Function *, CallInst *call,
+                     const std::set<Function *> &callees,
+                     bool degraded) override {
+    unsigned line = call->getDebugLoc().getLine();
+    lines[line].insert(callees.begin(), callees.end());
+    if (degraded) {
+      degradedLines.insert(line);
+    }
+  }
+
+  void finish() override {
+    for (const auto &line : lines) {
+      out << line.first << " : ";
+      std::vector<StringRef> names = getCalleeNames(line.second);
+      for (auto iter = names.begin(); iter != names.end(); iter++) {
+        if (iter != names.begin()) {
+          out << ", ";
+        }
+        out << *iter;
+      }
+      out << "\n";
+    }
+    if (!degradedLines.empty()) {
+      out << "degraded : ";
+      for (auto iter = degradedLines.begin(); iter != degradedLines.end();
+           iter++) {
+        out << (iter == degradedLines.begin() ? "" : ", ") << *iter;
+      }
+      out << "\n";
+    }
+  }
+
+private:
+  raw_ostream &out;
+  std::map<unsigned, std::set<Function *>> lines;
+  std::set<unsigned> degradedLines;
+};
+
+///
+/// 每个调用点一行 JSON：
+/// {"root":"moo","file":"test20.c","line":47,"column":14,"caller":"moo",
+///  "callees":["clever","foo"]}
+/// 近似的结果多一个 "degraded":true；间接调用点多一个 "candidates"，是所有类型兼容、
+/// 被取过地址的函数个数，即分析结果可能的最大值。懒加载和跨模块导入时没有这个上界
+///
+class JSONLinesResultWriter : public ResultWriter {
+public:
+  explicit JSONLinesResultWriter(raw_ostream &out) : out(out) {}
+
+  void writeCallSite(Function *root, CallInst *call,
+                     const std::set<Function *> &callees,
+                     bool degraded) override {
+    const DebugLoc &loc = call->getDebugLoc();
+    {
+      json::OStream json(out);
+      json.object([&]() {
+        json.attribute("root", root->getName());
+        json.attribute("file", getFile(call));
+        json.attribute("line", loc ? loc.getLine() : 0);
+        json.attribute("column", loc ? loc.getCol() : 0);
+        json.attribute("caller", call->getFunction()->getName());
+        json.attributeArray("callees", [&]() {
+          for (StringRef name : getCalleeNames(callees)) {
+            json.value(name);
+          }
+        });
+        if (degraded) {
+          json.attribute("degraded", true);
+        }
+        if (size_t bound = getCandidateBound(call)) {
+          json.attribute("candidates", int64_t(bound));
+        }
+      });
+    }
+    out << "\n";
+    out.flush();
+  }
+
+private:
+  raw_ostream &out;
+};
+
+///
+/// 二进制记录：流的开头是 8 字节的 "PTRECv3\n"，之后是一条条记录。整数都是 4 字节
+/// 小端序，字符串是长度加内容（与摘要缓存文件相同）。每条记录以整条记录（不含这个长度
+/// 本身）的长度开头，然后是记录的种类：
+///   0 模块：文件名，批量分析时在每个模块的调用点记录之前
+///   1 调用点：root、file、line、column、caller、标志（1 表示近似结果）、
+///     被调函数个数、被调函数名
+/// 读者可以按长度跳过不认识的记录
+///
+class BinaryResultWriter : public ResultWriter {
+public:
+  enum RecordKind : uint32_t { ModuleRecord = 0, CallSiteRecord = 1 };
+
+  explicit BinaryResultWriter(raw_ostream &out) : out(out) {}
+
+  void writeCallSite(Function *root, CallInst *call,
+                     const std::set<Function *> &callees,
+                     bool degraded) override {
+    const DebugLoc &loc = call->getDebugLoc();
+    std::string record;
+    SummaryWriter writer(record);
+    writer.writeString(root->getName());
+    writer.writeString(getFile(call));
+    writer.writeInt(loc ? loc.getLine() : 0);
+    writer.writeInt(loc ? loc.getCol() : 0);
+    writer.writeString(call->getFunction()->getName());
+    writer.writeInt(degraded ? 1 : 0);
+    std::vector<StringRef> names = getCalleeNames(callees);
+    writer.writeInt(names.size());
+    for (StringRef name : names) {
+      writer.writeString(name);
+    }
+    writeRecord(out, CallSiteRecord, record);
+    out.flush();
+  }
+
+  static void writeRecord(raw_ostream &out, RecordKind kind, StringRef body) {
+    std::string header;
+    SummaryWriter writer(header);
+    writer.writeInt(4 + body.size());
+    writer.writeInt(kind);
+    out << header << body;
+  }
+
+private:
+  raw_ostream &out;
+};
+
+inline void ResultWriter::writeStreamHeader(OutputFormat format,
+                                            raw_ostream &out) {
+  if (format == OutputFormat::Binary) {
+    out << "PTRECv3\n";
+  }
+}
+
+inline void ResultWriter::writeModuleHeader(OutputFormat format,
+                                            raw_ostream &out, StringRef file) {
+  switch (format) {
+  case OutputFormat::JSONLines: {
+    {
+      json::OStream json(out);
+      json.object([&]() { json.attribute("module", file); });
+    }
+    out << "\n";
+    break;
+  }
+  case OutputFormat::Binary: {
+    std::string body;
+    SummaryWriter(body).writeString(file);
+    BinaryResultWriter::writeRecord(out, BinaryResultWriter::ModuleRecord,
+                                    body);
+    break;
+  }
+  case OutputFormat::Text:
+    out << "==> " << file << " <==\n";
+    break;
+  }
+}
+
+inline std::unique_ptr<ResultWriter> ResultWriter::create(OutputFormat format,
+                                                          raw_ostream &out) {
+  switch (format) {
+  case OutputFormat::JSONLines:
+    return std::unique_ptr<ResultWriter>(new JSONLinesResultWriter(out));
+  case OutputFormat::Binary:
+    return std::unique_ptr<ResultWriter>(new BinaryResultWriter(out));
+  case OutputFormat::Text:
+    break;
+  }
+  return std::unique_ptr<ResultWriter>(new TextResultWriter(out));
+}
+
+#endif // RESULT_WRITER_H
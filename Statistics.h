@@ -0,0 +1,220 @@
+#ifndef STATISTICS_H
+#define STATISTICS_H
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/Timer.h>
+#include <llvm/Support/raw_ostream.h>
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+
+#include "Budget.h"
+
+using namespace llvm;
+
+static cl::opt<std::string> StatsFile(
+    "analysis-stats",
+    cl::desc("Write analysis counters, phase times and peak memory as JSON to "
+             "<file> at exit ('-' for stdout)"),
+    cl::value_desc("file"), cl::init(""));
+
+inline bool isStatsEnabled() { return !StatsFile.empty(); }
+
+///
+/// 一次模块分析的计数器，由这次分析的所有 visitor 共享
+///
+struct AnalysisStats {
+  struct FunctionStats {
+    // 作为入口或者被调函数被分析（没有复用摘要）的次数
+    uint64_t analyses = 0;
+    // 所有这些分析中基本块被处理的次数
+    uint64_t blockVisits = 0;
+  };
+
+  uint64_t blockVisits = 0;
+  uint64_t transfers = 0; // 处理过的指令数
+  uint64_t merges = 0;    // 合并前驱状态的次数
+  // 状态大小在每次处理完基本块时记录，总和除以 blockVisits 得到平均值
+  uint64_t maxStateSize = 0;
+  uint64_t totalStateSize = 0;
+  uint64_t summaryHits = 0;
+  uint64_t summaryMisses = 0;
+  unsigned maxCallDepth = 0;
+  // 函数指针绑定中因为类型对不上而没有分析的被调函数
+  uint64_t filteredCallees = 0;
+  // 超出各种预算而改用近似分析的调用次数，以及结果是近似的调用点个数
+  uint64_t approximatedCalls[static_cast<unsigned>(BudgetKind::NumKinds)] = {};
+  uint64_t degradedCallSites = 0;
+  DenseMap<const Function *, FunctionStats> functions;
+
+  void recordStateSize(uint64_t size) {
+    maxStateSize = std::max(maxStateSize, size);
+    totalStateSize += size;
+  }
+};
+
+///
+/// 进程内所有分析的统计，程序退出前写成一个 JSON 报告
+///
+/// 批处理模式下多个模块同时分析，每次分析结束时把自己的计数器加进来；
+/// 阶段计时也按阶段累加，最后构造一个 TimerGroup 输出
+///
+class StatsReport {
+public:
+  static StatsReport &get() {
+    static StatsReport report;
+    return report;
+  }
+
+  void addModule(const Module &M, const AnalysisStats &stats) {
+    std::lock_guard<std::mutex> lock(mutex);
+    modules++;
+    total.blockVisits += stats.blockVisits;
+    total.transfers += stats.transfers;
+    total.merges += stats.merges;
+    total.maxStateSize = std::max(total.maxStateSize, stats.maxStateSize);
+    total.totalStateSize += stats.totalStateSize;
+    total.summaryHits += stats.summaryHits;
+    total.summaryMisses += stats.summaryMisses;
+    total.maxCallDepth = std::max(total.maxCallDepth, stats.maxCallDepth);
+    total.filteredCallees += stats.filteredCallees;
+    for (unsigned i = 0; i < unsigned(BudgetKind::NumKinds); i++) {
+      total.approximatedCalls[i] += stats.approximatedCalls[i];
+    }
+    total.degradedCallSites += stats.degradedCallSites;
+    for (const auto &entry : stats.functions) {
+      functions.push_back({M.getModuleIdentifier(),
+                           entry.first->getName().str(), entry.second});
+    }
+  }
+
+  void addTime(StringRef phase, const TimeRecord &time) {
+    std::lock_guard<std::mutex> lock(mutex);
+    phases[phase] += time;
+  }
+
+  /// 分析次数最多的函数排在前面，最容易看出哪些函数被反复分析
+  bool write(raw_ostream &err) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::error_code ec;
+    raw_fd_ostream out(StatsFile, ec, sys::fs::OF_Text);
+    if (ec) {
+      err << StatsFile << ": " << ec.message() << "\n";
+      return false;
+    }
+    std::stable_sort(functions.begin(), functions.end(),
+                     [](const FunctionEntry &a, const FunctionEntry &b) {
+                       return a.stats.analyses > b.stats.analyses;
+                     });
+
+    json::OStream json(out, 2);
+    json.object([&]() {
+      json.attribute("modules", modules);
+      json.attributeObject("counters", [&]() {
+        json.attribute("block_visits", total.blockVisits);
+        json.attribute("transfers", total.transfers);
+        json.attribute("merges", total.merges);
+        json.attribute("max_state_size", total.maxStateSize);
+        json.attribute("avg_state_size",
+                       total.blockVisits ? double(total.totalStateSize) /
+                                               total.blockVisits
+                                         : 0.0);
+        json.attribute("summary_hits", total.summaryHits);
+        json.attribute("summary_misses", total.summaryMisses);
+        json.attribute("max_call_depth", total.maxCallDepth);
+        json.attribute("filtered_callees", total.filteredCallees);
+        json.attribute("degraded_call_sites", total.degradedCallSites);
+      });
+      json.attributeObject("approximated_calls", [&]() {
+        for (unsigned i = 1; i < unsigned(BudgetKind::NumKinds); i++) {
+          json.attribute(getBudgetName(BudgetKind(i)),
+                         total.approximatedCalls[i]);
+        }
+      });
+      json.attributeArray("functions", [&]() {
+        for (const FunctionEntry &entry : functions) {
+          json.object([&]() {
+            json.attribute("module", entry.module);
+            json.attribute("function", entry.function);
+            json.attribute("analyses", entry.stats.analyses);
+            json.attribute("block_visits", entry.stats.blockVisits);
+          });
+        }
+      });
+      json.attributeObject("phases", [&]() {
+        for (const char *phase : {"parse", "mem2reg", "analysis", "output"}) {
+          const TimeRecord &time = phases[phase];
+          json.attributeObject(phase, [&]() {
+            json.attribute("wall", time.getWallTime());
+            json.attribute("user", time.getUserTime());
+            json.attribute("sys", time.getSystemTime());
+          });
+        }
+      });
+      json.attribute("peak_rss_kb", getPeakRSS());
+    });
+    out << "\n";
+
+    // 同样的计时按 LLVM 的格式打印到错误输出，便于人看
+    TimerGroup group("pta", "Point-to analysis phases", phases);
+    group.print(err);
+    return true;
+  }
+
+private:
+  struct FunctionEntry {
+    std::string module;
+    std::string function;
+    AnalysisStats::FunctionStats stats;
+  };
+
+  std::mutex mutex;
+  unsigned modules = 0;
+  AnalysisStats total;
+  std::vector<FunctionEntry> functions;
+  StringMap<TimeRecord> phases;
+
+  /// Linux 上 ru_maxrss 的单位是 KB
+  static int64_t getPeakRSS() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+      return -1;
+    }
+    return usage.ru_maxrss;
+  }
+};
+
+///
+/// 统计一个阶段的耗时，没有打开统计时什么也不做
+///
+class PhaseTimer {
+public:
+  explicit PhaseTimer(StringRef phase) : phase(phase) {
+    if (isStatsEnabled()) {
+      start = TimeRecord::getCurrentTime(/*Start=*/true);
+    }
+  }
+
+  ~PhaseTimer() {
+    if (isStatsEnabled()) {
+      TimeRecord time = TimeRecord::getCurrentTime(/*Start=*/false);
+      time -= start;
+      StatsReport::get().addTime(phase, time);
+    }
+  }
+
+private:
+  StringRef phase;
+  TimeRecord start;
+};
+
+#endif // STATISTICS_H
@@ -0,0 +1,434 @@
+#ifndef SUMMARY_STORE_H
+#define SUMMARY_STORE_H
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/ModuleSlotTracker.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MD5.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
+#include <algorithm>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace llvm;
+
+static cl::opt<std::string> SummaryCachePath(
+    "summary-cache",
+    cl::desc("Load callee summaries from and save them to this file (or one "
+             "file per module if it is a directory)"),
+    cl::value_desc("path"), cl::init(""));
+
+///
+/// 把 IR 中的值编码成与内存地址无关的字符串，并计算函数内容的哈希
+///
+/// 全局的值按名字编码，函数内的值按它在函数中的位置编码（第几个形参、第几条指令），
+/// 只要函数本身没有变化，编码就是稳定的。没有名字的全局值无法编码。
+///
+/// 函数的键由它自己的结构哈希和它（传递地）引用的所有函数的结构哈希组成，
+/// 任何一个可能被调用的函数发生变化，键都会随之改变。
+///
+class ValueCodec {
+public:
+  typedef std::function<void(Function *)> MaterializeFn;
+
+  /// @param materialize 计算哈希之前为没有函数体的函数读入函数体，可以为空
+  ValueCodec(Module &M, MaterializeFn materialize)
+      : M(M), materialize(std::move(materialize)) {}
+
+  /// @return 无法编码时返回空字符串
+  std::string encode(const Value *v) {
+    if (const GlobalValue *global = dyn_cast<GlobalValue>(v)) {
+      return global->hasName() ? "G" + global->getName().str() : "";
+    }
+    const Function *func = nullptr;
+    if (const Argument *arg = dyn_cast<Argument>(v)) {
+      func = arg->getParent();
+    } else if (const Instruction *inst = dyn_cast<Instruction>(v)) {
+      func = inst->getFunction();
+    }
+    if (!func || !func->hasName()) {
+      return "";
+    }
+    const FunctionInfo &info = getInfo(const_cast<Function *>(func));
+    auto iter = info.ids.find(v);
+    if (iter == info.ids.end()) {
+      return "";
+    }
+    return "L" + std::to_string(iter->second) + ":" + func->getName().str();
+  }
+
+  /// @return 编码对应的值已经不存在时返回空指针
+  Value *decode(StringRef code) {
+    if (code.consume_front("G")) {
+      return M.getNamedValue(code);
+    }
+    unsigned index;
+    if (!code.consume_front("L") || code.consumeInteger(10, index) ||
+        !code.consume_front(":")) {
+      return nullptr;
+    }
+    Function *func = M.getFunction(code);
+    if (!func) {
+      return nullptr;
+    }
+    if (func->empty() && materialize) {
+      materialize(func);
+    }
+    const FunctionInfo &info = getInfo(func);
+    return index < info.values.size() ? info.values[index] : nullptr;
+  }
+
+  /// 函数的键：自己和所有传递引用到的函数的结构哈希
+  MD5::MD5Result getFunctionKey(Function *F) {
+    auto cached = keys.find(F);
+    if (cached != keys.end()) {
+      return cached->second;
+    }
+
+    std::vector<Function *> closure = {F};
+    SmallPtrSet<Function *, 16> visited = {F};
+    for (size_t i = 0; i < closure.size(); i++) {
+      for (Function *ref : getInfo(closure[i]).refs) {
+        if (visited.insert(ref).second) {
+          closure.push_back(ref);
+        }
+      }
+    }
+    std::sort(closure.begin() + 1, closure.end(),
+              [](Function *a, Function *b) {
+                return a->getName() < b->getName();
+              });
+
+    MD5 hash;
+    for (Function *func : closure) {
+      hash.update(func->getName());
+      hash.update(getInfo(func).hash.Bytes);
+    }
+    MD5::MD5Result key;
+    hash.final(key);
+    keys[F] = key;
+    return key;
+  }
+
+private:
+  struct FunctionInfo {
+    bool hasBody = false;
+    DenseMap<const Value *, unsigned> ids;
+    std::vector<Value *> values;
+    std::vector<Function *> refs; // 函数体中直接引用的函数
+    MD5::MD5Result hash;
+  };
+
+  Module &M;
+  MaterializeFn materialize;
+  DenseMap<const Function *, std::unique_ptr<FunctionInfo>> infos;
+  DenseMap<const Function *, MD5::MD5Result> keys;
+
+  const FunctionInfo &getInfo(Function *F) {
+    if (F->empty() && materialize) {
+      materialize(F);
+    }
+    std::unique_ptr<FunctionInfo> &info = infos[F];
+    // 声明之后可能被导入了函数体，这时要重新计算
+    if (!info || info->hasBody != !F->empty()) {
+      info.reset(new FunctionInfo());
+      buildInfo(F, *info);
+      keys.clear();
+    }
+    return *info;
+  }
+
+  void buildInfo(Function *F, FunctionInfo &info) {
+    info.hasBody = !F->empty();
+    for (Argument &arg : F->args()) {
+      info.ids[&arg] = info.values.size();
+      info.values.push_back(&arg);
+    }
+    for (Instruction &inst : instructions(F)) {
+      info.ids[&inst] = info.values.size();
+      info.values.push_back(&inst);
+    }
+
+    MD5 hash;
+    std::string text;
+    raw_string_ostream out(text);
+    out << *F->getFunctionType() << " " << F->getName() << "\n";
+
+    // 行号会影响分析结果，单独计入
+    ModuleSlotTracker slots(&M, /*ShouldInitializeAllMetadata=*/false);
+    slots.incorporateFunction(*F);
+    SmallPtrSet<Function *, 16> refs;
+    for (BasicBlock &bb : *F) {
+      out << "bb\n";
+      for (Instruction &inst : bb) {
+        if (isa<DbgInfoIntrinsic>(&inst)) {
+          continue;
+        }
+        printInstruction(inst, out, slots);
+        out << " @" << (inst.getDebugLoc() ? inst.getDebugLoc().getLine() : 0)
+            << "\n";
+        for (Value *operand : inst.operands()) {
+          collectFunctionRefs(operand, refs);
+        }
+      }
+    }
+    out.flush();
+    hash.update(text);
+    hash.final(info.hash);
+
+    info.refs.assign(refs.begin(), refs.end());
+  }
+
+  /// 打印指令中影响分析的部分。不用 Instruction::print，它会打印元数据附件，
+  /// 元数据的编号会随模块中其他函数的变化而变化，而计算键不能修改正在分析的 IR
+  static void printInstruction(Instruction &inst, raw_ostream &out,
+                               ModuleSlotTracker &slots) {
+    if (!inst.getType()->isVoidTy()) {
+      inst.printAsOperand(out, /*PrintType=*/false, slots);
+      out << " = ";
+    }
+    out << inst.getOpcodeName() << " " << *inst.getType();
+    if (CmpInst *cmp = dyn_cast<CmpInst>(&inst)) {
+      out << " " << CmpInst::getPredicateName(cmp->getPredicate());
+    } else if (AllocaInst *alloca = dyn_cast<AllocaInst>(&inst)) {
+      out << " " << *alloca->getAllocatedType();
+    } else if (GetElementPtrInst *gep = dyn_cast<GetElementPtrInst>(&inst)) {
+      out << " " << *gep->getSourceElementType();
+    } else if (CallBase *call = dyn_cast<CallBase>(&inst)) {
+      out << " " << *call->getFunctionType();
+    } else if (ExtractValueInst *extract = dyn_cast<ExtractValueInst>(&inst)) {
+      for (unsigned index : extract->indices()) {
+        out << " " << index;
+      }
+    } else if (InsertValueInst *insert = dyn_cast<InsertValueInst>(&inst)) {
+      for (unsigned index : insert->indices()) {
+        out << " " << index;
+      }
+    }
+    for (Value *operand : inst.operands()) {
+      out << ", ";
+      // 元数据参数（比如一些 intrinsic 的参数）同样没有稳定的编号
+      if (isa<MetadataAsValue>(operand)) {
+        out << "metadata";
+      } else {
+        operand->printAsOperand(out, /*PrintType=*/true, slots);
+      }
+    }
+    if (PHINode *phi = dyn_cast<PHINode>(&inst)) {
+      for (BasicBlock *block : phi->blocks()) {
+        out << ", ";
+        block->printAsOperand(out, /*PrintType=*/false, slots);
+      }
+    }
+  }
+
+  /// 操作数中直接或者在常量表达式里出现的函数
+  static void collectFunctionRefs(Value *v, SmallPtrSetImpl<Function *> &refs) {
+    if (Function *func = dyn_cast<Function>(v)) {
+      refs.insert(func);
+    } else if (ConstantExpr *expr = dyn_cast<ConstantExpr>(v)) {
+      for (Value *operand : expr->operands()) {
+        collectFunctionRefs(operand, refs);
+      }
+    }
+  }
+};
+
+///
+/// 摘要记录的二进制编码，整数都是小端序的 32 位数，字符串前面是它的长度
+///
+class SummaryWriter {
+public:
+  explicit SummaryWriter(std::string &buffer) : buffer(buffer) {}
+
+  void writeInt(uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+      buffer.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+    }
+  }
+
+  void writeString(StringRef s) {
+    writeInt(s.size());
+    buffer.append(s.begin(), s.end());
+  }
+
+private:
+  std::string &buffer;
+};
+
+class SummaryReader {
+public:
+  explicit SummaryReader(StringRef data) : data(data) {}
+
+  /// 数据被截断时返回 0 并记下错误，调用者最后检查 failed()
+  uint32_t readInt() {
+    if (data.size() < 4) {
+      error = true;
+      data = StringRef();
+      return 0;
+    }
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++) {
+      value |= static_cast<uint32_t>(static_cast<uint8_t>(data[i])) << (8 * i);
+    }
+    data = data.drop_front(4);
+    return value;
+  }
+
+  StringRef readString() {
+    uint32_t size = readInt();
+    if (size > data.size()) {
+      error = true;
+      data = StringRef();
+      return StringRef();
+    }
+    StringRef s = data.take_front(size);
+    data = data.drop_front(size);
+    return s;
+  }
+
+  bool failed() const { return error; }
+
+private:
+  StringRef data;
+  bool error = false;
+};
+
+///
+/// 保存摘要的缓存文件
+///
+/// 文件由一个个记录组成：16 字节的键、4 字节的长度和摘要内容。打开时只扫描一遍
+/// 建立键到记录的索引，文件通过内存映射读入，摘要内容在命中时才被解码。
+/// 保存时只写入本次运行中用到的旧记录和新产生的记录，键已经失效的记录随之被淘汰。
+///
+class SummaryFile {
+public:
+  /// 文件不存在时得到一个空的缓存
+  /// @return 文件存在但格式不对时返回 false，错误信息写到 err
+  bool load(StringRef path, raw_ostream &err) {
+    auto file = MemoryBuffer::getFile(path, /*IsText=*/false,
+                                      /*RequiresNullTerminator=*/false);
+    if (!file) {
+      return file.getError() == std::errc::no_such_file_or_directory;
+    }
+    buffer = std::move(*file);
+    StringRef data = buffer->getBuffer();
+    if (!data.consume_front(Magic)) {
+      err << path << ": not a summary cache file\n";
+      buffer.reset();
+      return false;
+    }
+    while (!data.empty()) {
+      if (data.size() < KeySize + 4) {
+        err << path << ": truncated summary cache file\n";
+        return false;
+      }
+      StringRef key = data.take_front(KeySize);
+      SummaryReader reader(data.drop_front(KeySize));
+      StringRef payload = reader.readString();
+      if (reader.failed()) {
+        err << path << ": truncated summary cache file\n";
+        return false;
+      }
+      records[key.str()] = Record{payload, false};
+      data = data.drop_front(KeySize + 4 + payload.size());
+    }
+    return true;
+  }
+
+  /// 查找键对应的摘要内容，返回的内容在 SummaryFile 析构之前一直有效
+  bool lookup(const MD5::MD5Result &key, StringRef &payload) {
+    auto iter = records.find(toString(key));
+    if (iter == records.end()) {
+      return false;
+    }
+    iter->second.used = true;
+    payload = iter->second.payload;
+    return true;
+  }
+
+  void insert(const MD5::MD5Result &key, std::string payload) {
+    newPayloads.push_back(std::move(payload));
+    records[toString(key)] = Record{newPayloads.back(), true};
+  }
+
+  /// 先写到临时文件再改名，其他进程不会读到写了一半的文件。
+  /// 临时文件名是唯一的，同时保存同一个文件的进程不会写到一起
+  bool save(StringRef path, raw_ostream &err) const {
+    SmallString<128> tmpPath;
+    int fd;
+    if (std::error_code ec =
+            sys::fs::createUniqueFile(path + "-%%%%%%.tmp", fd, tmpPath)) {
+      err << path << ": " << ec.message() << "\n";
+      return false;
+    }
+    {
+      raw_fd_ostream out(fd, /*shouldClose=*/true);
+      out << Magic;
+      for (const auto &record : records) {
+        if (!record.second.used) {
+          continue;
+        }
+        std::string header;
+        SummaryWriter(header).writeInt(record.second.payload.size());
+        out << record.first << header << record.second.payload;
+      }
+    }
+    if (std::error_code ec = sys::fs::rename(tmpPath, path)) {
+      err << path << ": " << ec.message() << "\n";
+      sys::fs::remove(tmpPath);
+      return false;
+    }
+    return true;
+  }
+
+private:
+  static constexpr const char *Magic = "PTSUMv4\n";
+  static const size_t KeySize = 16;
+
+  struct Record {
+    StringRef payload; // 指向映射的文件或者 newPayloads
+    bool used;
+  };
+
+  std::unique_ptr<MemoryBuffer> buffer;
+  std::list<std::string> newPayloads; // 插入新元素不会让已有的 StringRef 失效
+  std::map<std::string, Record> records;
+
+  static std::string toString(const MD5::MD5Result &key) {
+    return std::string(key.Bytes.begin(), key.Bytes.end());
+  }
+};
+
+///
+/// 模块对应的缓存文件：-summary-cache 是目录时每个模块一个文件，文件名取自模块的来源
+///
+inline std::string getSummaryCacheFile(const Module &M) {
+  if (!sys::fs::is_directory(SummaryCachePath)) {
+    return SummaryCachePath;
+  }
+  MD5 hash;
+  hash.update(M.getModuleIdentifier());
+  MD5::MD5Result digest;
+  hash.final(digest);
+  SmallString<128> path(SummaryCachePath);
+  sys::path::append(path, digest.digest() + ".ptsum");
+  return path.str().str();
+}
+
+#endif // SUMMARY_STORE_H
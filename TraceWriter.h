@@ -0,0 +1,114 @@
+#ifndef TRACE_WRITER_H
+#define TRACE_WRITER_H
+
+#include <llvm/ADT/STLFunctionalExtras.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/Threading.h>
+#include <llvm/Support/raw_ostream.h>
+#include <chrono>
+#include <memory>
+#include <mutex>
+
+using namespace llvm;
+
+static cl::opt<std::string> TraceFile(
+    "trace",
+    cl::desc("Write a timeline of the analysis to <file> in the Chrome trace "
+             "event format (chrome://tracing, Perfetto)"),
+    cl::value_desc("file"), cl::init(""));
+
+///
+/// Chrome trace 格式的时间线
+///
+/// 每次 compForwardDataflow 和每次基本块处理是一个完整事件（"X"），递归分析被调函数
+/// 的事件在时间上包含于调用者的事件之内，查看时自然嵌套成调用链；摘要的命中和未命中
+/// 是瞬时事件（"i"）。事件在发生时直接写进文件，长时间的运行也不会在内存中积累。
+/// 批处理模式下每个线程是时间线上的一行。
+///
+class TraceWriter {
+public:
+  typedef function_ref<void(json::OStream &)> ArgsFn;
+
+  /// 没有打开 -trace 时返回空指针
+  static TraceWriter *get() {
+    if (TraceFile.empty()) {
+      return nullptr;
+    }
+    static std::unique_ptr<TraceWriter> writer(new TraceWriter());
+    return writer->out ? writer.get() : nullptr;
+  }
+
+  /// 从程序开始到现在的微秒数
+  static uint64_t now() {
+    static const auto start = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now() - start)
+        .count();
+  }
+
+  /// 从 start 开始到现在的事件，args 写入事件的参数
+  void complete(StringRef name, StringRef category, uint64_t start,
+                ArgsFn args) {
+    uint64_t end = now();
+    write([&](json::OStream &json) {
+      json.attribute("ph", "X");
+      json.attribute("name", name);
+      json.attribute("cat", category);
+      json.attribute("ts", int64_t(start));
+      json.attribute("dur", int64_t(end - start));
+      json.attributeObject("args", [&]() { args(json); });
+    });
+  }
+
+  void instant(StringRef name, StringRef category, ArgsFn args) {
+    uint64_t ts = now();
+    write([&](json::OStream &json) {
+      json.attribute("ph", "i");
+      json.attribute("s", "t");
+      json.attribute("name", name);
+      json.attribute("cat", category);
+      json.attribute("ts", int64_t(ts));
+      json.attributeObject("args", [&]() { args(json); });
+    });
+  }
+
+  ~TraceWriter() {
+    if (out) {
+      *out << "\n]}\n";
+    }
+  }
+
+private:
+  std::mutex mutex;
+  std::unique_ptr<raw_fd_ostream> out;
+  bool first = true;
+
+  TraceWriter() {
+    std::error_code ec;
+    out.reset(new raw_fd_ostream(TraceFile, ec, sys::fs::OF_Text));
+    if (ec) {
+      errs() << TraceFile << ": " << ec.message() << "\n";
+      out.reset();
+      return;
+    }
+    *out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  }
+
+  void write(function_ref<void(json::OStream &)> fields) {
+    uint64_t tid = get_threadid();
+    std::lock_guard<std::mutex> lock(mutex);
+    *out << (first ? "\n" : ",\n");
+    first = false;
+    json::OStream json(*out);
+    json.object([&]() {
+      json.attribute("pid", 1);
+      json.attribute("tid", int64_t(tid));
+      fields(json);
+    });
+  }
+};
+
+#endif // TRACE_WRITER_H
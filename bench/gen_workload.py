@@ -0,0 +1,405 @@
+#!/usr/bin/env python3
+"""生成规模可调的指向分析测试程序。
+
+程序的结构与 tests/ 中的用例类似，只是规模可以任意放大：
+
+  t0 .. t{N-1}        被间接调用的目标函数 int (int, int)
+  struct s0 .. s{D}   s0 中是函数指针，s{k} 中是指向 s{k-1} 的指针（test20 的 fsptr -> fptr）
+  dispatch_0 .. _{H}  调用链，dispatch_0 沿着结构体链取出函数指针做间接调用
+  rec_{i}_a/b         两两互相递归的函数，递归到底后进入调用链
+  driver_0 .. _{M-1}  每个 driver 按参数从 K 个目标中选一个放进结构体链，
+                      在 L 层嵌套循环里调用 dispatch_{H}（以及一个递归环）
+  main                依次调用所有 driver
+
+默认输出 LLVM IR（带调试信息，可以直接用 llvm-as 汇编），--lang=c 输出等价的 C 程序，
+需要像 compile.sh 一样用 clang -O0 -g 编译。
+"""
+
+import argparse
+import sys
+
+
+class Workload:
+    def __init__(self, args):
+        self.targets = max(1, args.functions)
+        self.depth = max(0, args.struct_depth)
+        self.fanout = max(1, args.fanout)
+        self.call_depth = max(0, args.call_depth)
+        self.cycles = max(0, args.recursion)
+        self.loops = max(0, args.loops)
+        self.drivers = max(1, args.drivers)
+        self.name = args.name
+
+    def driver_targets(self, j):
+        """driver j 可能选中的目标函数"""
+        return [(j * self.fanout + k) % self.targets for k in range(self.fanout)]
+
+
+class IREmitter:
+    """按 clang -O0 的风格输出 LLVM 14 的 IR（有类型指针）"""
+
+    FPTR = "i32 (i32, i32)*"
+
+    def __init__(self, w):
+        self.w = w
+        self.lines = []
+        self.metadata = []
+        self.next_md = 10
+        self.line = 1
+        self.tmp = 0
+
+    def struct(self, k):
+        return "%%struct.s%d" % k
+
+    def top(self):
+        return self.struct(self.w.depth)
+
+    def md(self, text):
+        n = self.next_md
+        self.next_md += 1
+        self.metadata.append("!%d = %s" % (n, text))
+        return "!%d" % n
+
+    def subprogram(self, name):
+        sp = self.md('distinct !DISubprogram(name: "%s", scope: !1, file: !1, '
+                     "line: %d, type: !5, scopeLine: %d, "
+                     "spFlags: DISPFlagDefinition, unit: !0)"
+                     % (name, self.line, self.line))
+        self.line += 1
+        return sp
+
+    def loc(self, sp):
+        """每个调用点单独占一行，文本输出中的行号互不相同"""
+        loc = self.md("!DILocation(line: %d, column: 3, scope: %s)"
+                      % (self.line, sp))
+        self.line += 1
+        return loc
+
+    def fresh(self, prefix):
+        self.tmp += 1
+        return "%%%s%d" % (prefix, self.tmp)
+
+    def emit(self):
+        w = self.w
+        out = self.lines
+        out.append("%struct.s0 = type { " + self.FPTR + " }")
+        for k in range(1, w.depth + 1):
+            out.append("%s = type { %s* }" % (self.struct(k), self.struct(k - 1)))
+        out.append("")
+
+        for i in range(w.targets):
+            sp = self.subprogram("t%d" % i)
+            out.append("define dso_local i32 @t%d(i32 %%a, i32 %%b) #0 !dbg %s {"
+                       % (i, sp))
+            out.append("entry:")
+            out.append("  %%m = mul nsw i32 %%b, %d" % (i + 1))
+            out.append("  %add = add nsw i32 %a, %m")
+            out.append("  ret i32 %add")
+            out.append("}")
+            out.append("")
+
+        self.emit_dispatch()
+        for i in range(w.cycles):
+            self.emit_recursion(i)
+        for j in range(w.drivers):
+            self.emit_driver(j)
+        self.emit_main()
+
+        out.append("attributes #0 = { noinline nounwind optnone uwtable }")
+        out.append("")
+        out.append("!llvm.dbg.cu = !{!0}")
+        out.append("!llvm.module.flags = !{!3, !4}")
+        out.append("")
+        out.append("!0 = distinct !DICompileUnit(language: DW_LANG_C99, "
+                   'file: !1, producer: "gen_workload", isOptimized: false, '
+                   "runtimeVersion: 0, emissionKind: FullDebug)")
+        out.append('!1 = !DIFile(filename: "%s.c", directory: ".")' % w.name)
+        out.append('!3 = !{i32 7, !"Dwarf Version", i32 4}')
+        out.append('!4 = !{i32 2, !"Debug Info Version", i32 3}')
+        out.append("!5 = !DISubroutineType(types: !6)")
+        out.append("!6 = !{null}")
+        out.extend(self.metadata)
+        return "\n".join(out) + "\n"
+
+    def emit_dispatch(self):
+        w = self.w
+        top = self.top()
+        for h in range(w.call_depth + 1):
+            sp = self.subprogram("dispatch_%d" % h)
+            out = self.lines
+            out.append("define dso_local i32 @dispatch_%d(%s* %%p, i32 %%a, "
+                       "i32 %%b) #0 !dbg %s {" % (h, top, sp))
+            out.append("entry:")
+            out.append("  %%p.addr = alloca %s*, align 8" % top)
+            out.append("  store %s* %%p, %s** %%p.addr, align 8" % (top, top))
+            out.append("  %%0 = load %s*, %s** %%p.addr, align 8" % (top, top))
+            if h > 0:
+                out.append("  %%r = call i32 @dispatch_%d(%s* %%0, i32 %%a, "
+                           "i32 %%b), !dbg %s" % (h - 1, top, self.loc(sp)))
+            else:
+                # 沿着结构体链一层层取下去，最后取出函数指针
+                cur = "%0"
+                for k in range(w.depth, 0, -1):
+                    gep = self.fresh("next")
+                    val = self.fresh("v")
+                    out.append("  %s = getelementptr inbounds %s, %s* %s, "
+                               "i32 0, i32 0"
+                               % (gep, self.struct(k), self.struct(k), cur))
+                    out.append("  %s = load %s*, %s** %s, align 8"
+                               % (val, self.struct(k - 1), self.struct(k - 1),
+                                  gep))
+                    cur = val
+                out.append("  %%fp.addr = getelementptr inbounds %%struct.s0, "
+                           "%%struct.s0* %s, i32 0, i32 0" % cur)
+                out.append("  %%fp = load %s, %s* %%fp.addr, align 8"
+                           % (self.FPTR, self.FPTR))
+                out.append("  %%r = call i32 %%fp(i32 %%a, i32 %%b), !dbg %s"
+                           % self.loc(sp))
+            out.append("  ret i32 %r")
+            out.append("}")
+            out.append("")
+
+    def emit_recursion(self, i):
+        top = self.top()
+        for side, other in (("a", "b"), ("b", "a")):
+            sp = self.subprogram("rec_%d_%s" % (i, side))
+            out = self.lines
+            out.append("define dso_local i32 @rec_%d_%s(%s* %%p, i32 %%n) #0 "
+                       "!dbg %s {" % (i, side, top, sp))
+            out.append("entry:")
+            out.append("  %cmp = icmp sgt i32 %n, 0")
+            out.append("  br i1 %cmp, label %recurse, label %base")
+            out.append("")
+            out.append("recurse:")
+            out.append("  %dec = sub nsw i32 %n, 1")
+            out.append("  %%r1 = call i32 @rec_%d_%s(%s* %%p, i32 %%dec), "
+                       "!dbg %s" % (i, other, top, self.loc(sp)))
+            out.append("  ret i32 %r1")
+            out.append("")
+            out.append("base:")
+            out.append("  %%r2 = call i32 @dispatch_%d(%s* %%p, i32 %%n, "
+                       "i32 %%n), !dbg %s" % (self.w.call_depth, top,
+                                               self.loc(sp)))
+            out.append("  ret i32 %r2")
+            out.append("}")
+            out.append("")
+
+    def emit_driver(self, j):
+        w = self.w
+        top = self.top()
+        sp = self.subprogram("driver_%d" % j)
+        out = self.lines
+        out.append("define dso_local i32 @driver_%d(i32 %%x) #0 !dbg %s {"
+                   % (j, sp))
+        out.append("entry:")
+        for k in range(w.depth + 1):
+            out.append("  %%s%d = alloca %s, align 8" % (k, self.struct(k)))
+        for l in range(w.loops):
+            out.append("  %%i%d = alloca i32, align 4" % l)
+        for k in range(1, w.depth + 1):
+            out.append("  %%link%d = getelementptr inbounds %s, %s* %%s%d, "
+                       "i32 0, i32 0" % (k, self.struct(k), self.struct(k), k))
+            out.append("  store %s* %%s%d, %s** %%link%d, align 8"
+                       % (self.struct(k - 1), k - 1, self.struct(k - 1), k))
+        out.append("  %fp.addr = getelementptr inbounds %struct.s0, "
+                   "%struct.s0* %s0, i32 0, i32 0")
+
+        # 按 x 的值从 fanout 个目标中选一个
+        targets = w.driver_targets(j)
+        out.append("  br label %sel0")
+        for k, t in enumerate(targets):
+            out.append("")
+            out.append("sel%d:" % k)
+            last = k == len(targets) - 1
+            if last:
+                out.append("  br label %%set%d" % k)
+            else:
+                out.append("  %%c%d = icmp eq i32 %%x, %d" % (k, k))
+                out.append("  br i1 %%c%d, label %%set%d, label %%sel%d"
+                           % (k, k, k + 1))
+            out.append("")
+            out.append("set%d:" % k)
+            out.append("  store %s @t%d, %s* %%fp.addr, align 8"
+                       % (self.FPTR, t, self.FPTR))
+            out.append("  br label %body")
+        out.append("")
+        out.append("body:")
+        self.emit_loops(0, sp, j)
+        out.append("  ret i32 0")
+        out.append("}")
+        out.append("")
+
+    def emit_loops(self, level, sp, j):
+        w = self.w
+        out = self.lines
+        if level == w.loops:
+            out.append("  %%call%d = call i32 @dispatch_%d(%s* %%s%d, i32 %%x, "
+                       "i32 %%x), !dbg %s" % (self.tmp, w.call_depth,
+                                               self.top(), w.depth,
+                                               self.loc(sp)))
+            self.tmp += 1
+            if w.cycles:
+                out.append("  %%call%d = call i32 @rec_%d_a(%s* %%s%d, i32 %%x), "
+                           "!dbg %s" % (self.tmp, j % w.cycles, self.top(),
+                                        w.depth, self.loc(sp)))
+                self.tmp += 1
+            return
+        out.append("  store i32 0, i32* %%i%d, align 4" % level)
+        out.append("  br label %%loop%d.cond" % level)
+        out.append("")
+        out.append("loop%d.cond:" % level)
+        out.append("  %%iv%d = load i32, i32* %%i%d, align 4" % (level, level))
+        out.append("  %%cmp%d = icmp slt i32 %%iv%d, 4" % (level, level))
+        out.append("  br i1 %%cmp%d, label %%loop%d.body, label %%loop%d.end"
+                   % (level, level, level))
+        out.append("")
+        out.append("loop%d.body:" % level)
+        self.emit_loops(level + 1, sp, j)
+        out.append("  %%iv%d.next = add nsw i32 %%iv%d, 1" % (level, level))
+        out.append("  store i32 %%iv%d.next, i32* %%i%d, align 4"
+                   % (level, level))
+        out.append("  br label %%loop%d.cond" % level)
+        out.append("")
+        out.append("loop%d.end:" % level)
+
+    def emit_main(self):
+        sp = self.subprogram("main")
+        out = self.lines
+        out.append("define dso_local i32 @main() #0 !dbg %s {" % sp)
+        out.append("entry:")
+        for j in range(self.w.drivers):
+            out.append("  %%d%d = call i32 @driver_%d(i32 %d), !dbg %s"
+                       % (j, j, j, self.loc(sp)))
+        out.append("  ret i32 0")
+        out.append("}")
+        out.append("")
+
+
+class CEmitter:
+    """输出与 IR 结构相同的 C 程序，风格与 tests/ 中的用例一致"""
+
+    def __init__(self, w):
+        self.w = w
+        self.out = []
+
+    def struct(self, k):
+        return "struct s%d" % k
+
+    def emit(self):
+        w = self.w
+        out = self.out
+        out.append("#include <stdlib.h>")
+        out.append("")
+        out.append("struct s0 {")
+        out.append("  int (*fptr)(int, int);")
+        out.append("};")
+        for k in range(1, w.depth + 1):
+            out.append("struct s%d {" % k)
+            out.append("  struct s%d *next;" % (k - 1))
+            out.append("};")
+        out.append("")
+        top = self.struct(w.depth)
+
+        for i in range(w.targets):
+            out.append("int t%d(int a, int b) { return a + b * %d; }"
+                       % (i, i + 1))
+        out.append("")
+
+        for h in range(w.call_depth + 1):
+            out.append("int dispatch_%d(%s *p, int a, int b) {" % (h, top))
+            if h > 0:
+                out.append("  return dispatch_%d(p, a, b);" % (h - 1))
+            else:
+                out.append("  return p%s->fptr(a, b);" % ("->next" * w.depth))
+            out.append("}")
+            out.append("")
+
+        if w.cycles:
+            for i in range(w.cycles):
+                out.append("int rec_%d_b(%s *p, int n);" % (i, top))
+            out.append("")
+        for i in range(w.cycles):
+            for side, other in (("a", "b"), ("b", "a")):
+                out.append("int rec_%d_%s(%s *p, int n) {" % (i, side, top))
+                out.append("  if (n > 0)")
+                out.append("    return rec_%d_%s(p, n - 1);" % (i, other))
+                out.append("  return dispatch_%d(p, n, n);" % w.call_depth)
+                out.append("}")
+                out.append("")
+
+        for j in range(w.drivers):
+            out.append("int driver_%d(int x) {" % j)
+            for k in range(w.depth + 1):
+                out.append("  struct s%d s%d;" % (k, k))
+            for k in range(1, w.depth + 1):
+                out.append("  s%d.next = &s%d;" % (k, k - 1))
+            targets = w.driver_targets(j)
+            for k, t in enumerate(targets):
+                if k == len(targets) - 1:
+                    prefix = "  " if k == 0 else "  else "
+                    out.append("%ss0.fptr = t%d;" % (prefix, t))
+                else:
+                    prefix = "  if" if k == 0 else "  else if"
+                    out.append("%s (x == %d) s0.fptr = t%d;" % (prefix, k, t))
+            indent = "  "
+            for l in range(w.loops):
+                out.append("%sfor (int i%d = 0; i%d < 4; i%d++) {"
+                           % (indent, l, l, l))
+                indent += "  "
+            out.append("%sdispatch_%d(&s%d, x, x);"
+                       % (indent, w.call_depth, w.depth))
+            if w.cycles:
+                out.append("%srec_%d_a(&s%d, x);"
+                           % (indent, j % w.cycles, w.depth))
+            for l in range(w.loops):
+                indent = indent[:-2]
+                out.append("%s}" % indent)
+            out.append("  return 0;")
+            out.append("}")
+            out.append("")
+
+        out.append("int main() {")
+        for j in range(w.drivers):
+            out.append("  driver_%d(%d);" % (j, j))
+        out.append("  return 0;")
+        out.append("}")
+        return "\n".join(out) + "\n"
+
+
+def add_workload_arguments(parser):
+    parser.add_argument("--functions", type=int, default=8,
+                        help="number of indirect call targets")
+    parser.add_argument("--struct-depth", type=int, default=1,
+                        help="levels of structs above the function pointer")
+    parser.add_argument("--fanout", type=int, default=2,
+                        help="targets each driver chooses from")
+    parser.add_argument("--call-depth", type=int, default=2,
+                        help="length of the dispatch call chain")
+    parser.add_argument("--recursion", type=int, default=0,
+                        help="number of mutual recursion cycles")
+    parser.add_argument("--loops", type=int, default=1,
+                        help="loop nesting around each call")
+    parser.add_argument("--drivers", type=int, default=4,
+                        help="number of driver functions called from main")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    add_workload_arguments(parser)
+    parser.add_argument("--lang", choices=["ll", "c"], default="ll")
+    parser.add_argument("--name", default="workload",
+                        help="source file name recorded in the debug info")
+    parser.add_argument("-o", "--output", default="-")
+    args = parser.parse_args()
+
+    w = Workload(args)
+    text = IREmitter(w).emit() if args.lang == "ll" else CEmitter(w).emit()
+    if args.output == "-":
+        sys.stdout.write(text)
+    else:
+        with open(args.output, "w") as f:
+            f.write(text)
+
+
+if __name__ == "__main__":
+    main()
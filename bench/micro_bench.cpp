@@ -0,0 +1,542 @@
+//===- micro_bench.cpp - Microbenchmarks of the analysis primitives -------===//
+//
+// 状态表示（PointToSets）和不动点迭代（compForwardDataflow）的微基准测试。
+// 修改状态的表示或者 worklist 时，可以单独测出这些基本操作的变化，不受整个分析
+// 中其他部分的干扰。
+//
+//   pta_microbench -json=results/HEAD.json
+//   pta_microbench -baseline=results/HEAD~1.json -filter=dataflow
+//
+//===----------------------------------------------------------------------===//
+
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Regex.h>
+#include <algorithm>
+#include <chrono>
+
+#include "PointToAnalysis.h"
+
+using namespace llvm;
+
+char PointToAnalysis::ID = 0;
+
+static cl::opt<std::string>
+    Filter("filter", cl::desc("Only run benchmarks whose name matches <regex>"),
+           cl::value_desc("regex"), cl::init(""));
+
+static cl::opt<double>
+    MinTime("min-time",
+            cl::desc("Minimum seconds measured per repetition (default 0.1)"),
+            cl::init(0.1));
+
+static cl::opt<unsigned>
+    Repetitions("repetitions",
+                cl::desc("Repetitions per benchmark, the median is reported"),
+                cl::init(5));
+
+static cl::opt<std::string>
+    JSONFile("json", cl::desc("Store the results as JSON in <file>"),
+             cl::value_desc("file"), cl::init(""));
+
+static cl::opt<std::string> BaselineFile(
+    "baseline",
+    cl::desc("Compare with the results stored by an earlier run (-json)"),
+    cl::value_desc("file"), cl::init(""));
+
+static cl::opt<double> Threshold(
+    "threshold",
+    cl::desc("Percent slowdown against the baseline reported as a regression "
+             "(default 10)"),
+    cl::init(10.0));
+
+namespace {
+
+/// 防止被测操作的结果被优化掉
+static volatile size_t Sink;
+
+///
+/// 一个基准测试：setup 准备数据（不计时）并返回被测的操作
+/// setup 和所有的操作都在同一个内存池中进行，和分析中的情况一致
+///
+struct Benchmark {
+  std::string name;
+  std::function<std::function<void()>()> setup;
+};
+
+struct Result {
+  std::string name;
+  uint64_t iterations;
+  double median; // 每次操作的纳秒数
+  double min;
+};
+
+///
+/// 测试数据：一组全局变量充当指针和被指向的对象
+///
+class Fixture {
+public:
+  explicit Fixture(LLVMContext &context)
+      : module(new Module("micro_bench", context)) {}
+
+  Module &getModule() { return *module; }
+
+  Value *getValue(unsigned i) {
+    while (values.size() <= i) {
+      values.push_back(new GlobalVariable(
+          *module, Type::getInt32Ty(module->getContext()), false,
+          GlobalValue::InternalLinkage, nullptr,
+          "v" + std::to_string(values.size())));
+    }
+    return values[i];
+  }
+
+  ///
+  /// 构造一个有 keys 个指针的状态，每个指针指向 setSize 个对象
+  /// salt 不同时各个指针指向的对象不同
+  ///
+  PointToSets makeState(unsigned keys, unsigned setSize, unsigned salt = 0) {
+    PointToSets state;
+    unsigned objects = keys * 2;
+    for (unsigned i = 0; i < keys; i++) {
+      ValueSet set;
+      for (unsigned j = 0; j < setSize; j++) {
+        set.insert(getValue(objects + (i * 7 + j * 13 + salt) % objects));
+      }
+      state.setPTS(getValue(i), std::move(set));
+    }
+    return state;
+  }
+
+  ///
+  /// 在状态中加入 tmps 个临时变量，每个绑定到 width 个指针上，
+  /// 和 load 二级指针得到的结果一样
+  ///
+  std::vector<Value *> addBindings(PointToSets &state, unsigned keys,
+                                   unsigned tmps, unsigned width) {
+    std::vector<Value *> result;
+    for (unsigned i = 0; i < tmps; i++) {
+      Value *tmp = getValue(keys * 3 + i);
+      ValueSet targets;
+      for (unsigned j = 0; j < width; j++) {
+        targets.insert(getValue((i + j * 5) % keys));
+      }
+      state.setBinding(tmp, std::move(targets));
+      result.push_back(tmp);
+    }
+    return result;
+  }
+
+private:
+  std::unique_ptr<Module> module;
+  std::vector<Value *> values;
+};
+
+///
+/// 构造不动点迭代用的合成 CFG
+///
+/// 函数的形式和 -O0 编译出的代码相同：指针都存放在 entry 中的 alloca 里，基本块
+/// 通过 store 和 load 读写这些指针，一部分 load 出来的指针再经过绑定写回，
+/// 迭代中既有指向集的变化也有绑定的变化
+///
+class CFGBuilder {
+public:
+  CFGBuilder(Module &module, StringRef name, unsigned slots)
+      : module(module), builder(module.getContext()) {
+    LLVMContext &context = module.getContext();
+    Type *int32Ty = Type::getInt32Ty(context);
+    FunctionType *fnTy =
+        FunctionType::get(Type::getVoidTy(context), {int32Ty}, false);
+    fn = Function::Create(fnTy, GlobalValue::ExternalLinkage, name, module);
+    arg = fn->getArg(0);
+    BasicBlock *entry = newBlock("entry");
+    builder.SetInsertPoint(entry);
+    pointerTy = int32Ty->getPointerTo();
+    for (unsigned i = 0; i < slots; i++) {
+      this->slots.push_back(builder.CreateAlloca(pointerTy));
+    }
+    holder = builder.CreateAlloca(pointerTy->getPointerTo());
+    for (unsigned i = 0; i < slots * 2; i++) {
+      objects.push_back(new GlobalVariable(
+          module, int32Ty, false, GlobalValue::InternalLinkage, nullptr,
+          name + ".obj" + std::to_string(i)));
+    }
+  }
+
+  Function *getFunction() { return fn; }
+
+  BasicBlock *newBlock(const Twine &name) {
+    return BasicBlock::Create(module.getContext(), name, fn);
+  }
+
+  /// 在当前基本块末尾写入一组指针操作，seed 决定读写哪些指针
+  void emitBody(unsigned seed) {
+    unsigned n = slots.size();
+    Value *slot = slots[seed % n];
+    // p = &obj
+    builder.CreateStore(objects[seed % objects.size()], slot);
+    // q = p
+    Value *loaded = builder.CreateLoad(pointerTy, slots[(seed + 1) % n]);
+    builder.CreateStore(loaded, slots[(seed + 2) % n]);
+    // holder = &p; *holder = &obj
+    builder.CreateStore(slot, holder);
+    Value *target = builder.CreateLoad(pointerTy->getPointerTo(), holder);
+    builder.CreateStore(objects[(seed * 3 + 1) % objects.size()], target);
+  }
+
+  Value *condition(unsigned i) {
+    return builder.CreateICmpEQ(arg, builder.getInt32(i));
+  }
+
+  void setInsertPoint(BasicBlock *block) { builder.SetInsertPoint(block); }
+  void br(BasicBlock *dest) { builder.CreateBr(dest); }
+  void condBr(unsigned i, BasicBlock *a, BasicBlock *b) {
+    builder.CreateCondBr(condition(i), a, b);
+  }
+  void ret() { builder.CreateRetVoid(); }
+
+private:
+  Module &module;
+  IRBuilder<> builder;
+  Function *fn;
+  Value *arg;
+  Type *pointerTy;
+  std::vector<Value *> slots;
+  Value *holder;
+  std::vector<Value *> objects;
+};
+
+/// n 个首尾相连的菱形，每个分支写不同的指针
+static Function *buildDiamondChain(Module &module, unsigned n) {
+  CFGBuilder cfg(module, "diamonds" + std::to_string(n), 8);
+  for (unsigned i = 0; i < n; i++) {
+    BasicBlock *left = cfg.newBlock("left");
+    BasicBlock *right = cfg.newBlock("right");
+    BasicBlock *join = cfg.newBlock("join");
+    cfg.condBr(i, left, right);
+    cfg.setInsertPoint(left);
+    cfg.emitBody(i * 2);
+    cfg.br(join);
+    cfg.setInsertPoint(right);
+    cfg.emitBody(i * 2 + 1);
+    cfg.br(join);
+    cfg.setInsertPoint(join);
+  }
+  cfg.ret();
+  return cfg.getFunction();
+}
+
+/// depth 层嵌套循环，每层的循环体中都有指针操作，指向关系要沿回边传播多轮才收敛
+static Function *buildNestedLoops(Module &module, unsigned depth) {
+  CFGBuilder cfg(module, "loops" + std::to_string(depth), 8);
+  std::vector<BasicBlock *> headers, exits;
+  for (unsigned i = 0; i < depth; i++) {
+    BasicBlock *header = cfg.newBlock("header");
+    BasicBlock *body = cfg.newBlock("body");
+    BasicBlock *exit = cfg.newBlock("exit");
+    cfg.br(header);
+    cfg.setInsertPoint(header);
+    cfg.condBr(i, body, exit);
+    cfg.setInsertPoint(body);
+    cfg.emitBody(i);
+    headers.push_back(header);
+    exits.push_back(exit);
+  }
+  // 从最内层开始依次关闭循环
+  for (unsigned i = depth; i-- > 0;) {
+    cfg.emitBody(i + depth);
+    cfg.br(headers[i]);
+    cfg.setInsertPoint(exits[i]);
+  }
+  cfg.ret();
+  return cfg.getFunction();
+}
+
+/// n 个不可归约的区域：a 和 b 互为前驱，都可以从区域入口直接进入
+static Function *buildIrreducible(Module &module, unsigned n) {
+  CFGBuilder cfg(module, "irreducible" + std::to_string(n), 8);
+  for (unsigned i = 0; i < n; i++) {
+    BasicBlock *a = cfg.newBlock("a");
+    BasicBlock *b = cfg.newBlock("b");
+    BasicBlock *exit = cfg.newBlock("exit");
+    cfg.condBr(i, a, b);
+    cfg.setInsertPoint(a);
+    cfg.emitBody(i * 2);
+    cfg.condBr(i + 1, b, exit);
+    cfg.setInsertPoint(b);
+    cfg.emitBody(i * 2 + 1);
+    cfg.condBr(i + 2, a, exit);
+    cfg.setInsertPoint(exit);
+  }
+  cfg.ret();
+  return cfg.getFunction();
+}
+
+/// 和分析中一样，每次在新的内存池上从头计算一个函数的不动点
+static std::function<void()> dataflowOp(Function *fn) {
+  return [fn]() {
+    StateArena arena;
+    ArenaScope scope(arena);
+    PointToVisitor visitor;
+    DataflowResult<PointToSets>::Type result;
+    PointToSets initval;
+    compForwardDataflow(fn, &visitor, &result, initval);
+    Sink = result.size();
+  };
+}
+
+static std::vector<Benchmark> registerBenchmarks(Fixture &fixture) {
+  std::vector<Benchmark> benchmarks;
+  auto add = [&benchmarks](std::string name,
+                           std::function<std::function<void()>()> setup) {
+    benchmarks.push_back({std::move(name), std::move(setup)});
+  };
+
+  for (unsigned keys : {16u, 256u}) {
+    std::string size = "/" + std::to_string(keys);
+
+    add("copy" + size, [&fixture, keys]() {
+      auto state = std::make_shared<PointToSets>(fixture.makeState(keys, 8));
+      return [state]() {
+        PointToSets copy = *state;
+        Sink = copy.getPointToSets().size();
+      };
+    });
+
+    // 不动点迭代中最常见的情况：前驱的状态已经全部包含在内，合并不改变状态
+    add("merge/subsumed" + size, [&fixture, keys]() {
+      auto dest = std::make_shared<PointToSets>(fixture.makeState(keys, 8));
+      auto src = std::make_shared<PointToSets>(*dest);
+      return [dest, src]() {
+        PointToVisitor visitor;
+        visitor.merge(dest.get(), *src);
+        Sink = dest->getPointToSets().size();
+      };
+    });
+
+    // 合并会改变目标，每次都要从拷贝开始，结果减去 copy 的时间才是合并本身
+    add("merge/disjoint" + size, [&fixture, keys]() {
+      auto dest = std::make_shared<PointToSets>(fixture.makeState(keys, 8));
+      auto src = std::make_shared<PointToSets>(fixture.makeState(keys, 8, 1));
+      return [dest, src]() {
+        PointToVisitor visitor;
+        PointToSets copy = *dest;
+        visitor.merge(&copy, *src);
+        Sink = copy.getPointToSets().size();
+      };
+    });
+
+    // 指纹相同时要做一次深比较（除非打开 -trust-fingerprint）
+    add("equal/identical" + size, [&fixture, keys]() {
+      auto a = std::make_shared<PointToSets>(fixture.makeState(keys, 8));
+      auto b = std::make_shared<PointToSets>(*a);
+      return [a, b]() { Sink = *a == *b; };
+    });
+
+    add("equal/different" + size, [&fixture, keys]() {
+      auto a = std::make_shared<PointToSets>(fixture.makeState(keys, 8));
+      auto b = std::make_shared<PointToSets>(*a);
+      b->addPTS(fixture.getValue(0), {fixture.getValue(keys * 4)});
+      return [a, b]() { Sink = *a == *b; };
+    });
+
+    add("getPTS" + size, [&fixture, keys]() {
+      auto state = std::make_shared<PointToSets>(fixture.makeState(keys, 8));
+      std::vector<Value *> pointers;
+      for (unsigned i = 0; i < keys; i++) {
+        pointers.push_back(fixture.getValue(i));
+      }
+      return [state, pointers]() {
+        size_t total = 0;
+        for (Value *p : pointers) {
+          total += state->getPTS(p).size();
+        }
+        Sink = total;
+      };
+    });
+
+    // 经过绑定查询指向集，每个临时变量绑定到 4 个指针上
+    add("forEachPTS/binding" + size, [&fixture, keys]() {
+      auto state = std::make_shared<PointToSets>(fixture.makeState(keys, 8));
+      std::vector<Value *> tmps = fixture.addBindings(*state, keys, keys, 4);
+      return [state, tmps]() {
+        size_t total = 0;
+        for (Value *tmp : tmps) {
+          state->forEachPTS(tmp, [&total](Value *) { total++; });
+        }
+        Sink = total;
+      };
+    });
+  }
+
+  for (unsigned n : {16u, 64u}) {
+    add("dataflow/diamonds/" + std::to_string(n), [&fixture, n]() {
+      return dataflowOp(buildDiamondChain(fixture.getModule(), n));
+    });
+  }
+  for (unsigned depth : {2u, 4u}) {
+    add("dataflow/loops/" + std::to_string(depth), [&fixture, depth]() {
+      return dataflowOp(buildNestedLoops(fixture.getModule(), depth));
+    });
+  }
+  for (unsigned n : {8u, 32u}) {
+    add("dataflow/irreducible/" + std::to_string(n), [&fixture, n]() {
+      return dataflowOp(buildIrreducible(fixture.getModule(), n));
+    });
+  }
+  return benchmarks;
+}
+
+static double runIterations(const std::function<void()> &op,
+                            uint64_t iterations) {
+  auto start = std::chrono::steady_clock::now();
+  for (uint64_t i = 0; i < iterations; i++) {
+    op();
+  }
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+///
+/// 先把迭代次数翻倍直到一次测量超过 MinTime，然后用这个次数测 Repetitions 次，
+/// 取每次操作耗时的中位数
+///
+static Result runBenchmark(const Benchmark &benchmark) {
+  StateArena arena;
+  ArenaScope scope(arena);
+  std::function<void()> op = benchmark.setup();
+
+  uint64_t iterations = 1;
+  while (runIterations(op, iterations) < MinTime && iterations < (1u << 30)) {
+    iterations *= 2;
+  }
+  std::vector<double> samples;
+  for (unsigned i = 0; i < std::max(1u, unsigned(Repetitions)); i++) {
+    samples.push_back(runIterations(op, iterations) * 1e9 / iterations);
+  }
+  std::sort(samples.begin(), samples.end());
+  return {benchmark.name, iterations, samples[samples.size() / 2],
+          samples.front()};
+}
+
+static bool writeJSON(const std::vector<Result> &results) {
+  std::error_code ec;
+  raw_fd_ostream out(JSONFile, ec, sys::fs::OF_Text);
+  if (ec) {
+    errs() << JSONFile << ": " << ec.message() << "\n";
+    return false;
+  }
+  json::OStream json(out, 2);
+  json.object([&]() {
+    json.attributeArray("benchmarks", [&]() {
+      for (const Result &result : results) {
+        json.object([&]() {
+          json.attribute("name", result.name);
+          json.attribute("iterations", int64_t(result.iterations));
+          json.attribute("ns_per_op", result.median);
+          json.attribute("min_ns_per_op", result.min);
+        });
+      }
+    });
+  });
+  out << "\n";
+  return true;
+}
+
+/// 读入之前保存的结果，返回名字到每次操作纳秒数的映射
+static bool readBaseline(StringMap<double> &baseline) {
+  ErrorOr<std::unique_ptr<MemoryBuffer>> buffer =
+      MemoryBuffer::getFile(BaselineFile);
+  if (!buffer) {
+    errs() << BaselineFile << ": " << buffer.getError().message() << "\n";
+    return false;
+  }
+  Expected<json::Value> value = json::parse((*buffer)->getBuffer());
+  if (!value) {
+    errs() << BaselineFile << ": " << toString(value.takeError()) << "\n";
+    return false;
+  }
+  const json::Object *root = value->getAsObject();
+  const json::Array *entries = root ? root->getArray("benchmarks") : nullptr;
+  if (!entries) {
+    errs() << BaselineFile << ": no benchmarks\n";
+    return false;
+  }
+  for (const json::Value &entry : *entries) {
+    const json::Object *object = entry.getAsObject();
+    if (!object) {
+      continue;
+    }
+    Optional<StringRef> name = object->getString("name");
+    Optional<double> ns = object->getNumber("ns_per_op");
+    if (name && ns) {
+      baseline[*name] = *ns;
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  cl::ParseCommandLineOptions(argc, argv,
+                              "Microbenchmarks of the point-to analysis.\n");
+
+  Regex filter(Filter.empty() ? StringRef(".*") : StringRef(Filter));
+  std::string error;
+  if (!filter.isValid(error)) {
+    errs() << "-filter: " << error << "\n";
+    return 1;
+  }
+  StringMap<double> baseline;
+  if (!BaselineFile.empty() && !readBaseline(baseline)) {
+    return 1;
+  }
+
+  LLVMContext context;
+  Fixture fixture(context);
+  std::vector<Result> results;
+  unsigned regressions = 0;
+  outs() << left_justify("benchmark", 28) << right_justify("iterations", 13)
+         << right_justify("ns/op", 15) << right_justify("min ns/op", 15);
+  if (!baseline.empty()) {
+    outs() << right_justify("baseline", 15) << right_justify("change", 9);
+  }
+  outs() << "\n";
+
+  for (const Benchmark &benchmark : registerBenchmarks(fixture)) {
+    if (!filter.match(benchmark.name)) {
+      continue;
+    }
+    Result result = runBenchmark(benchmark);
+    results.push_back(result);
+    outs() << format("%-28s %12llu %14.1f %14.1f", result.name.c_str(),
+                     (unsigned long long)result.iterations, result.median,
+                     result.min);
+    auto iter = baseline.find(result.name);
+    if (iter != baseline.end() && iter->second > 0) {
+      double change = (result.median / iter->second - 1) * 100;
+      outs() << format(" %14.1f %+7.1f%%", iter->second, change);
+      if (change > Threshold) {
+        outs() << "  REGRESSION";
+        regressions++;
+      }
+    }
+    outs() << "\n";
+    outs().flush();
+  }
+
+  if (!JSONFile.empty() && !writeJSON(results)) {
+    return 1;
+  }
+  if (regressions) {
+    errs() << regressions << " benchmark(s) slower than the baseline by more "
+           << "than " << format("%.1f", double(Threshold)) << "%\n";
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,264 @@
+#!/usr/bin/env python3
+"""在 tests/ 上运行分析，检查结果并记录每个用例的耗时和峰值内存。
+
+每个用例末尾的注释（比如 `// 47 : foo, clever`）给出了期望的输出，被调函数的顺序
+不重要。用例先像 compile.sh 一样用 clang 编译成 bitcode，也可以用 --bc-dir 指定
+已经编译好的目录。
+
+用例中有 `// warm-up: <file>` 时，还会先分析 <file> 填充一个摘要缓存文件，再用这个
+缓存分析用例，结果同样要符合期望，用来检查缓存不会用上已经过时的摘要。
+
+结果和基线文件比较：
+  - 基线中通过的用例失败了，是精度回退；基线中就失败的用例只报告，不算回退
+  - 耗时（多次运行取最小值）比基线慢了超过 --threshold 而且超过 --min-delta 秒，
+    是性能回退
+有回退时返回值非零。基线文件不存在或者给出 --update-baseline 时，把这次的结果
+写成新的基线。
+
+  bench/regress.py --binary build/assignment3 --baseline build/regress.json
+"""
+
+import argparse
+import json
+import os
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+EXPECT = re.compile(r"^\s*//+\s*(\d+)\s*:\s*(.*?)\s*$")
+WARM_UP = re.compile(r"^\s*//+\s*warm-up:\s*(\S+)\s*$")
+OUTPUT = re.compile(r"^(\d+) : (.*)$")
+
+
+def parse_callees(text):
+    return frozenset(c.strip() for c in text.split(",") if c.strip())
+
+
+def read_expectations(path):
+    expected = {}
+    with open(path) as f:
+        for line in f:
+            m = EXPECT.match(line)
+            if m:
+                expected[int(m.group(1))] = parse_callees(m.group(2))
+    return expected
+
+
+def parse_output(text):
+    actual = {}
+    for line in text.splitlines():
+        m = OUTPUT.match(line)
+        if m:
+            actual[int(m.group(1))] = parse_callees(m.group(2))
+    return actual
+
+
+def diff_results(expected, actual):
+    """返回不一致的描述，一致时为空"""
+    problems = []
+    for line in sorted(set(expected) | set(actual)):
+        want = expected.get(line)
+        got = actual.get(line)
+        if want == got:
+            continue
+        fmt = lambda s: ", ".join(sorted(s)) if s is not None else "(none)"
+        problems.append("line %d: expected %s, got %s" % (line, fmt(want),
+                                                          fmt(got)))
+    return problems
+
+
+def read_warm_up(path):
+    with open(path) as f:
+        for line in f:
+            m = WARM_UP.match(line)
+            if m:
+                return m.group(1)
+    return None
+
+
+def compile_test(clang, source, bc):
+    subprocess.run([clang, "-emit-llvm", "-c", "-O0", "-g3", source, "-o", bc],
+                   check=True, stdout=subprocess.DEVNULL)
+
+
+def run_once(cmd, timeout):
+    """运行一次，返回 (退出码, 输出, 秒数, 峰值内存 KB)
+
+    用 os.wait4 回收子进程，才能拿到这一个进程自己的 ru_maxrss
+    """
+    with tempfile.TemporaryFile() as out:
+        start = time.monotonic()
+        proc = subprocess.Popen(cmd, stdout=out, stderr=subprocess.STDOUT)
+        timer = threading.Timer(timeout, proc.kill)
+        timer.start()
+        try:
+            _, status, usage = os.wait4(proc.pid, 0)
+        finally:
+            timer.cancel()
+        elapsed = time.monotonic() - start
+        proc.returncode = os.waitstatus_to_exitcode(status)
+        out.seek(0)
+        text = out.read().decode(errors="replace")
+    return proc.returncode, text, elapsed, usage.ru_maxrss
+
+
+def run_test(args, name, bc, expected):
+    cmd = [args.binary, bc] + args.extra
+    best_time = None
+    peak_rss = 0
+    for _ in range(max(1, args.repeat)):
+        code, text, elapsed, rss = run_once(cmd, args.timeout)
+        if code != 0:
+            return {"status": "fail", "time": elapsed, "peak_rss_kb": rss,
+                    "problems": ["exit code %d" % code]}
+        best_time = elapsed if best_time is None else min(best_time, elapsed)
+        peak_rss = max(peak_rss, rss)
+    problems = diff_results(expected, parse_output(text))
+    return {"status": "fail" if problems else "pass", "time": best_time,
+            "peak_rss_kb": peak_rss, "problems": problems}
+
+
+def run_warm(args, bc, warm_bc, expected, workdir):
+    """先分析 warm_bc 写出摘要缓存，再带着缓存分析 bc，返回不一致的描述"""
+    cache = os.path.join(workdir, os.path.basename(bc) + ".ptsum")
+    if os.path.exists(cache):
+        os.remove(cache)
+    for target in (warm_bc, bc):
+        code, text, _, _ = run_once([args.binary, "-summary-cache=" + cache,
+                                     target] + args.extra, args.timeout)
+        if code != 0:
+            return ["warm cache: exit code %d" % code]
+    return ["warm cache: " + p for p in diff_results(expected,
+                                                     parse_output(text))]
+
+
+def load_baseline(path):
+    if not path or not os.path.exists(path):
+        return None
+    with open(path) as f:
+        return json.load(f).get("tests", {})
+
+
+def save_baseline(path, baseline, results):
+    """没有运行的用例（比如被 --filter 排除的）保留原来的记录"""
+    tests = dict(baseline or {})
+    for name, result in results.items():
+        tests[name] = {k: result[k] for k in ("status", "time", "peak_rss_kb")}
+    with open(path + ".tmp", "w") as f:
+        json.dump({"tests": tests}, f, indent=2, sort_keys=True)
+        f.write("\n")
+    os.replace(path + ".tmp", path)
+
+
+def main():
+    root = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--binary", required=True,
+                        help="the analysis executable (assignment3)")
+    parser.add_argument("--tests", default=os.path.join(root, "tests"),
+                        help="directory of test*.c (default tests/)")
+    parser.add_argument("--bc-dir", default="",
+                        help="use the bitcode already compiled in this "
+                             "directory instead of running clang")
+    parser.add_argument("--clang", default="clang")
+    parser.add_argument("--baseline", default="",
+                        help="baseline file of earlier results")
+    parser.add_argument("--update-baseline", action="store_true",
+                        help="overwrite the baseline with this run")
+    parser.add_argument("--threshold", type=float, default=20.0,
+                        help="percent slowdown reported as a regression")
+    parser.add_argument("--min-delta", type=float, default=0.05,
+                        help="ignore slowdowns smaller than this many seconds")
+    parser.add_argument("--repeat", type=int, default=3,
+                        help="runs per test, the fastest is recorded")
+    parser.add_argument("--timeout", type=float, default=300)
+    parser.add_argument("--filter", default="",
+                        help="only run tests whose name matches <regex>")
+    parser.add_argument("extra", nargs="*",
+                        help="extra options for the analysis (after --)")
+    args = parser.parse_args()
+
+    sources = sorted(f for f in os.listdir(args.tests) if f.endswith(".c"))
+    sources = [f for f in sources if re.search(args.filter, f)]
+    if not args.bc_dir and not shutil.which(args.clang):
+        print("%s not found, compile the tests first and use --bc-dir"
+              % args.clang, file=sys.stderr)
+        return 1
+    workdir = tempfile.mkdtemp(prefix="pta-regress-")
+
+    baseline = load_baseline(args.baseline)
+    results = {}
+    regressions = 0
+    print("%-10s %-6s %10s %10s %10s %8s" % ("test", "result", "time",
+                                              "rss KB", "baseline", "change"))
+    try:
+        for source in sources:
+            name = source[:-2]
+            expected = read_expectations(os.path.join(args.tests, source))
+            if args.bc_dir:
+                bc = os.path.join(args.bc_dir, name + ".bc")
+                if not os.path.exists(bc):
+                    print("%-10s %-6s" % (name, "skip"))
+                    continue
+            else:
+                bc = os.path.join(workdir, name + ".bc")
+                compile_test(args.clang, os.path.join(args.tests, source), bc)
+
+            result = run_test(args, name, bc, expected)
+            warm_up = read_warm_up(os.path.join(args.tests, source))
+            if warm_up:
+                warm_name = os.path.splitext(warm_up)[0]
+                if args.bc_dir:
+                    warm_bc = os.path.join(args.bc_dir, warm_name + ".bc")
+                else:
+                    warm_bc = os.path.join(workdir, warm_name + ".bc")
+                    compile_test(args.clang,
+                                 os.path.join(args.tests, warm_up), warm_bc)
+                problems = run_warm(args, bc, warm_bc, expected, workdir)
+                result["problems"] += problems
+                if problems:
+                    result["status"] = "fail"
+            results[name] = result
+            old = baseline.get(name) if baseline else None
+            line = "%-10s %-6s %10.3f %10d" % (name, result["status"],
+                                              result["time"],
+                                              result["peak_rss_kb"])
+            notes = list(result["problems"])
+            if old:
+                change = (result["time"] / old["time"] - 1) * 100 \
+                    if old["time"] > 0 else 0.0
+                line += " %10.3f %+7.1f%%" % (old["time"], change)
+                if result["status"] == "fail" and old["status"] == "pass":
+                    notes.insert(0, "PRECISION REGRESSION")
+                    regressions += 1
+                elif result["status"] == "pass" and old["status"] == "fail":
+                    notes.insert(0, "now passes")
+                if result["status"] == "pass" and change > args.threshold \
+                        and result["time"] - old["time"] > args.min_delta:
+                    notes.insert(0, "SLOWDOWN")
+                    regressions += 1
+            elif result["status"] == "fail":
+                # 没有基线可以对照时，任何不符合期望的结果都算失败
+                regressions += 1
+            print(line)
+            for note in notes:
+                print("    " + note)
+            sys.stdout.flush()
+    finally:
+        shutil.rmtree(workdir, ignore_errors=True)
+
+    passed = sum(1 for r in results.values() if r["status"] == "pass")
+    print("%d/%d passed, %d regression(s)" % (passed, len(results),
+                                               regressions))
+    if args.baseline and (baseline is None or args.update_baseline):
+        save_baseline(args.baseline, baseline, results)
+        print("baseline written to %s" % args.baseline)
+    return 1 if regressions else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
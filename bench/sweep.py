@@ -0,0 +1,123 @@
+#!/usr/bin/env python3
+"""按规模扫描生成的测试程序，记录分析的时间和内存曲线。
+
+每个取值生成一个模块（gen_workload.py），用 llvm-as 汇编以后交给分析程序，
+通过 -analysis-stats 取回各阶段耗时、峰值内存和计数器，每个取值一行写进 CSV。
+超时或者崩溃的运行也会记录下来，status 列说明原因。
+
+  bench/sweep.py --binary build/assignment3 --param functions \\
+      --values 8,16,32,64,128 --fanout 4 -o functions.csv
+"""
+
+import argparse
+import csv
+import json
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import gen_workload  # noqa: E402
+
+PARAMS = ["functions", "struct_depth", "fanout", "call_depth", "recursion",
+          "loops", "drivers"]
+
+COLUMNS = PARAMS + [
+    "status", "wall", "parse", "mem2reg", "analysis", "output",
+    "peak_rss_kb", "block_visits", "transfers", "merges", "max_state_size",
+    "summary_hits", "summary_misses", "max_call_depth", "module_bytes",
+]
+
+
+def find_llvm_as(llvm_dir):
+    if llvm_dir:
+        return os.path.join(llvm_dir, "bin", "llvm-as")
+    for candidate in ("llvm-as", "llvm-as-14"):
+        for path in os.environ.get("PATH", "").split(os.pathsep):
+            if os.access(os.path.join(path, candidate), os.X_OK):
+                return candidate
+    return "/usr/lib/llvm-14/bin/llvm-as"
+
+
+def run_point(args, workdir, values):
+    """生成、汇编并分析一个模块，返回 CSV 的一行"""
+    ns = argparse.Namespace(name="sweep", **values)
+    row = dict(values)
+    ll = os.path.join(workdir, "sweep.ll")
+    bc = os.path.join(workdir, "sweep.bc")
+    stats = os.path.join(workdir, "stats.json")
+    with open(ll, "w") as f:
+        f.write(gen_workload.IREmitter(gen_workload.Workload(ns)).emit())
+    subprocess.run([args.llvm_as, ll, "-o", bc], check=True)
+    row["module_bytes"] = os.path.getsize(bc)
+    if os.path.exists(stats):
+        os.remove(stats)
+
+    cmd = [args.binary, bc, "-analysis-stats=" + stats] + args.extra
+    start = time.monotonic()
+    try:
+        proc = subprocess.run(cmd, stdout=subprocess.DEVNULL,
+                              stderr=subprocess.DEVNULL, timeout=args.timeout)
+        row["status"] = "ok" if proc.returncode == 0 else \
+            "exit %d" % proc.returncode
+    except subprocess.TimeoutExpired:
+        row["status"] = "timeout"
+    row["wall"] = "%.4f" % (time.monotonic() - start)
+
+    if row["status"] == "ok" and os.path.exists(stats):
+        with open(stats) as f:
+            report = json.load(f)
+        for phase, time_record in report["phases"].items():
+            row[phase] = "%.4f" % time_record["wall"]
+        row["peak_rss_kb"] = report["peak_rss_kb"]
+        for name, value in report["counters"].items():
+            if name in COLUMNS:
+                row[name] = value
+    return row
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    gen_workload.add_workload_arguments(parser)
+    parser.add_argument("--binary", required=True,
+                        help="the analysis executable (assignment3)")
+    parser.add_argument("--param", required=True,
+                        choices=[p.replace("_", "-") for p in PARAMS],
+                        help="the parameter to sweep")
+    parser.add_argument("--values", required=True,
+                        help="comma separated values of the swept parameter")
+    parser.add_argument("--timeout", type=float, default=600,
+                        help="seconds before a run is recorded as timeout")
+    parser.add_argument("--llvm-dir", default="",
+                        help="LLVM installation providing llvm-as")
+    parser.add_argument("-o", "--output", default="-", help="CSV file")
+    parser.add_argument("extra", nargs="*",
+                        help="extra options for the analysis (after --)")
+    args = parser.parse_args()
+    args.llvm_as = find_llvm_as(args.llvm_dir)
+
+    param = args.param.replace("-", "_")
+    base = {p: getattr(args, p) for p in PARAMS}
+    out = sys.stdout if args.output == "-" else open(args.output, "w",
+                                                     newline="")
+    writer = csv.DictWriter(out, fieldnames=COLUMNS, restval="")
+    writer.writeheader()
+    with tempfile.TemporaryDirectory() as workdir:
+        for value in args.values.split(","):
+            values = dict(base)
+            values[param] = int(value)
+            row = run_point(args, workdir, values)
+            writer.writerow(row)
+            out.flush()
+            print("%s=%s: %s %ss %s KB" % (param, value, row["status"],
+                                           row["wall"],
+                                           row.get("peak_rss_kb", "?")),
+                  file=sys.stderr)
+    if out is not sys.stdout:
+        out.close()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,36 @@
+#include <stdlib.h>
+
+typedef void (*fptr)();
+
+void foo() {
+}
+
+void f1(fptr **a) {
+    fptr *p = (fptr *)malloc(sizeof(fptr));
+    *p = foo;
+    *a = p;
+}
+
+void bar() {
+}
+
+void baz() {
+}
+
+void f2(fptr **a) {
+    (**a)();
+}
+
+int main(int x) {
+    fptr *pp = 0;
+    void (*gg)(fptr **) = f1;
+    if (x > 1) {
+        gg = f2;
+    }
+    gg(&pp);
+    return 0;
+}
+
+// 9 : malloc
+// 21 : foo
+// 30 : f1, f2
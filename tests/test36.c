@@ -0,0 +1,21 @@
+#include <stdlib.h>
+
+int plus(int a, int b) {
+   return a+b;
+}
+
+int minus(int a, int b) {
+   return a-b;
+}
+
+int moo(int x) {
+    int (*af_ptr)(int, int) = plus;
+    int i;
+    for (i = 0; i < x; i++) {
+        af_ptr(1, i);
+        af_ptr = minus;
+    }
+    return 0;
+}
+
+// 15 : plus, minus
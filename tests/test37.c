@@ -0,0 +1,26 @@
+#include <stdlib.h>
+
+void h() {
+}
+
+void k() {
+}
+
+void g() {
+    k();
+}
+
+void f(void (*fp)()) {
+    fp();
+}
+
+int main() {
+    f(g);
+    return 0;
+}
+
+// 先用上一个版本 test38.c 填充摘要缓存，再分析这个文件，结果要与不用缓存时相同
+// warm-up: test38.c
+// 10 : k
+// 14 : g
+// 18 : f
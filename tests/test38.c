@@ -0,0 +1,25 @@
+#include <stdlib.h>
+
+void h() {
+}
+
+void k() {
+}
+
+void g() {
+    h();
+}
+
+void f(void (*fp)()) {
+    fp();
+}
+
+int main() {
+    f(g);
+    return 0;
+}
+
+// test37.c 的上一个版本，g 调用的是 h，test37 用它填充摘要缓存
+// 10 : h
+// 14 : g
+// 18 : f
@@ -1,15 +1,121 @@
 #ifndef MYUTILS_H
 #define MYUTILS_H
 
-#ifdef DEBUG
-#define LOG_DEBUG(msg)                                                         \
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/raw_ostream.h>
+#include <memory>
+#include <mutex>
+#include <string>
+
+///
+/// 分级、分类的运行时日志
+///
+/// 是否输出在格式化之前判断，关闭的日志只多一次整数比较，消息中的表达式（比如整个状态的
+/// 打印）不会被求值。编译时没有定义 PTA_LOGGING 时所有日志语句都是空的。
+/// 日志先写进缓冲区，一行一行整体写出，多个线程的日志不会交错在一行里。
+///
+enum class LogLevel { Error, Warning, Info, Debug, Trace };
+
+enum LogCategory : unsigned {
+  LogDataflow, // 不动点迭代：基本块的处理顺序和状态
+  LogTransfer, // 单条指令的转移函数
+  LogCall,     // 函数调用的参数绑定、递归分析和写回
+  LogSummary,  // 被调函数摘要的复用
+  LogLoad,     // 懒加载和跨模块导入
+};
+
+static llvm::cl::opt<LogLevel> LogLevelOpt(
+    "log-level", llvm::cl::desc("Messages up to this level are logged"),
+    llvm::cl::values(clEnumValN(LogLevel::Error, "error", ""),
+                     clEnumValN(LogLevel::Warning, "warning", ""),
+                     clEnumValN(LogLevel::Info, "info", ""),
+                     clEnumValN(LogLevel::Debug, "debug", ""),
+                     clEnumValN(LogLevel::Trace, "trace",
+                                "Also dump the whole state around every basic "
+                                "block and call")),
+    llvm::cl::init(LogLevel::Warning));
+
+static llvm::cl::bits<LogCategory> LogCategories(
+    "log",
+    llvm::cl::desc("Only log these categories (comma separated, default all)"),
+    llvm::cl::values(clEnumValN(LogDataflow, "dataflow", ""),
+                     clEnumValN(LogTransfer, "transfer", ""),
+                     clEnumValN(LogCall, "call", ""),
+                     clEnumValN(LogSummary, "summary", ""),
+                     clEnumValN(LogLoad, "load", "")),
+    llvm::cl::CommaSeparated);
+
+static llvm::cl::opt<std::string>
+    LogFile("log-file", llvm::cl::desc("Write the log to <file> (default stderr)"),
+            llvm::cl::value_desc("file"), llvm::cl::init(""));
+
+inline bool isLogEnabled(LogLevel level, LogCategory category) {
+  return level <= LogLevelOpt &&
+         (LogCategories.getBits() == 0 || LogCategories.isSet(category));
+}
+
+///
+/// 日志的输出位置，第一次写日志时打开，缓冲区在程序退出时写出
+///
+class LogSink {
+public:
+  static void write(LogLevel level, LogCategory category, llvm::StringRef msg) {
+    static const char *const levelNames[] = {"error", "warning", "info",
+                                             "debug", "trace"};
+    static const char *const categoryNames[] = {"dataflow", "transfer", "call",
+                                                "summary", "load"};
+    LogSink &sink = get();
+    std::lock_guard<std::mutex> lock(sink.mutex);
+    *sink.out << "[" << levelNames[static_cast<int>(level)] << ":"
+              << categoryNames[category] << "] " << msg << "\n";
+    // 错误和警告要及时看到，不等缓冲区满
+    if (level <= LogLevel::Warning) {
+      sink.out->flush();
+    }
+  }
+
+private:
+  std::mutex mutex;
+  std::unique_ptr<llvm::raw_fd_ostream> out;
+
+  LogSink() {
+    if (!LogFile.empty()) {
+      std::error_code ec;
+      out.reset(new llvm::raw_fd_ostream(LogFile, ec, llvm::sys::fs::OF_Text));
+      if (!ec) {
+        return;
+      }
+      llvm::errs() << LogFile << ": " << ec.message() << "\n";
+    }
+    // errs() 没有缓冲，日志另外开一个带缓冲的流写到同一个文件描述符
+    out.reset(new llvm::raw_fd_ostream(2, /*shouldClose=*/false));
+  }
+
+  static LogSink &get() {
+    static LogSink sink;
+    return sink;
+  }
+};
+
+#ifdef PTA_LOGGING
+#define PTA_LOG(level, category, msg)                                          \
   do {                                                                         \
-    errs() << "\u001b[33m[DEBUG] \u001b[0m" << msg << "\n";                    \
+    if (isLogEnabled(level, category)) {                                       \
+      std::string logMessage;                                                  \
+      llvm::raw_string_ostream logStream(logMessage);                          \
+      logStream << msg;                                                        \
+      LogSink::write(level, category, logStream.str());                        \
+    }                                                                          \
   } while (0)
 #else
-#define LOG_DEBUG(msg)                                                         \
+#define PTA_LOG(level, category, msg)                                          \
   do {                                                                         \
   } while (0)
 #endif
 
-#endif // MYUTILS_H
\ No newline at end of file
+#define LOG_INFO(category, msg) PTA_LOG(LogLevel::Info, category, msg)
+#define LOG_DEBUG(category, msg) PTA_LOG(LogLevel::Debug, category, msg)
+#define LOG_TRACE(category, msg) PTA_LOG(LogLevel::Trace, category, msg)
+
+#endif // MYUTILS_H